@@ -5,15 +5,21 @@
 #include <cmath>
 #include <numbers>
 #include <vector>
-#include <tuple>
 #include <memory>
 #include <assert.h>
 #include <chrono>
+#include <algorithm>
+#include "float4.h"
 
 #define FLOAT_EPSILON 1e-6f
+#define FLOAT_MAX 3.402823466e+38f // avoid INFINITY, it isn't reliable under -ffast-math
 
-bool fequal(float a, float b);
+inline bool fequal(float a, float b) {
+    return std::abs(a - b) < FLOAT_EPSILON;
+}
 
+// vector and point math is defined here so it inlines into every translation unit,
+// constexpr where the standard allows it (no sqrt / trig)
 class Vector3D {
 public:
     // basic vectors
@@ -31,85 +37,154 @@ public:
     float z;
 
     // construct function
-    Vector3D() : x(0.0f), y(0.0f), z(0.0f) {}
-    Vector3D(float x, float y, float z) : x(x), y(y), z(z) {}
-    Vector3D(const Vector3D &) = default;
-    Vector3D &operator=(const Vector3D &) = default;
+    constexpr Vector3D() : x(0.0f), y(0.0f), z(0.0f) {}
+    constexpr Vector3D(float x, float y, float z) : x(x), y(y), z(z) {}
+    constexpr Vector3D(const Vector3D &) = default;
+    constexpr Vector3D &operator=(const Vector3D &) = default;
 
     // print function
     friend std::ostream &operator<<(std::ostream &out, const Vector3D &v);
 
     // operations
-    Vector3D operator+(const Vector3D &v) const; // vector + vector
+    constexpr Vector3D operator+(const Vector3D &v) const { return Vector3D(x + v.x, y + v.y, z + v.z); } // vector + vector
 
-    Vector3D operator-(const Vector3D &v) const; // vector - vector
+    constexpr Vector3D operator-(const Vector3D &v) const { return Vector3D(x - v.x, y - v.y, z - v.z); } // vector - vector
 
-    Vector3D operator*(float val) const;                     // vector * scalar
-    friend Vector3D operator*(float val, const Vector3D &v); // scalar * vector
-    Vector3D operator*(const Vector3D &v) const;             // multiply each component
+    constexpr Vector3D operator*(float val) const { return Vector3D(x * val, y * val, z * val); }         // vector * scalar
+    friend constexpr Vector3D operator*(float val, const Vector3D &v) { return v * val; }                 // scalar * vector
+    constexpr Vector3D operator*(const Vector3D &v) const { return Vector3D(x * v.x, y * v.y, z * v.z); } // multiply each component
 
-    Vector3D operator/(float val) const; // vector / scalar
+    constexpr Vector3D operator/(float val) const { return Vector3D(x / val, y / val, z / val); } // vector / scalar
 
-    bool operator==(const Vector3D &v) const; // equal operator
-    bool operator!=(const Vector3D &v) const; // non-equal operator
+    bool operator==(const Vector3D &v) const { return fequal(x, v.x) && fequal(y, v.y) && fequal(z, v.z); } // equal operator
+    bool operator!=(const Vector3D &v) const { return !(*this == v); }                                     // non-equal operator
 
-    float dot(const Vector3D &v) const; // inner product
-    static float dot(const Vector3D &v1, const Vector3D &v2);
+    constexpr float dot(const Vector3D &v) const { return x * v.x + y * v.y + z * v.z; } // inner product
+    static constexpr float dot(const Vector3D &v1, const Vector3D &v2) { return v1.dot(v2); }
 
-    Vector3D cross(const Vector3D &v) const; // outer product
-    static Vector3D cross(const Vector3D &v1, const Vector3D &v2);
+    constexpr Vector3D cross(const Vector3D &v) const { return Vector3D(y * v.z - z * v.y, z * v.x - x * v.z, x * v.y - y * v.x); } // outer product
+    static constexpr Vector3D cross(const Vector3D &v1, const Vector3D &v2) { return v1.cross(v2); }
 
-    void normalize();            // normalize the vector itself
-    Vector3D normalized() const; // return the normalized vector
+    void normalize() { *this = normalized(); }                            // normalize the vector itself
+    Vector3D normalized() const { return *this * rsqrt(sqrMagnitude()); } // return the normalized vector, through rsqrt (float4.h)
 
-    float sqrMagnitude() const; // return the square of the length
-    float magnitude() const;    // return the length
+    constexpr float sqrMagnitude() const { return x * x + y * y + z * z; } // return the square of the length
+    float magnitude() const { return std::sqrt(sqrMagnitude()); }          // return the length
 
     static float angle(const Vector3D &v1, const Vector3D &v2);                              // calculate the angle between two vectors (0 to 180)
     static float signedAngle(const Vector3D &from, const Vector3D &to, const Vector3D &dir); // calculate the angle between two vectors (-180 to 180)
 
-    static Vector3D mix(const Vector3D &v1, const Vector3D &v2, float p); // linear mix algorithm
+    static constexpr Vector3D mix(const Vector3D &v1, const Vector3D &v2, float p) { return v1 * (1 - p) + v2 * p; } // linear mix algorithm
+
+    float4 load() const { return float4(x, y, z); } // into a simd register, w = 0
 };
 
 // this is a utils class, help to implement some operation of angle
 class Angle {
 public:
-    static float degToRad(float deg);
-    static float radToDeg(float rad);
+    static constexpr float degToRad(float deg) { return deg * std::numbers::pi / 180; }
+    static constexpr float radToDeg(float rad) { return rad * 180 / std::numbers::pi; }
 };
 
+// a position, misses are told apart by Hit::missed, not by the point
 class Point {
 public:
     static const Point zero;
-    static const Point none;
 
 public:
     float x;
     float y;
     float z;
 
-    bool is_none;
-
     // construct function
-    Point(bool n = false) : x(0.0f), y(0.0f), z(0.0f), is_none(n) {}
-    Point(float x, float y, float z) : x(x), y(y), z(z), is_none(false) {}
-    Point(const Point &) = default;
-    Point &operator=(const Point &) = default;
+    constexpr Point() : x(0.0f), y(0.0f), z(0.0f) {}
+    constexpr Point(float x, float y, float z) : x(x), y(y), z(z) {}
+    constexpr Point(const Point &) = default;
+    constexpr Point &operator=(const Point &) = default;
 
     // print function
     friend std::ostream &operator<<(std::ostream &out, const Point &v);
 
     // operations
-    Point operator+(const Vector3D &v) const;                  // point + vector
-    friend Point operator+(const Vector3D &v, const Point &p); // vector + point, equal to point + vector
+    constexpr Point operator+(const Vector3D &v) const { return Point(x + v.x, y + v.y, z + v.z); } // point + vector
+    friend constexpr Point operator+(const Vector3D &v, const Point &p) { return p + v; }          // vector + point, equal to point + vector
+
+    constexpr Vector3D operator-(const Point &p) const { return Vector3D(x - p.x, y - p.y, z - p.z); } // point - point
+    constexpr Point operator-(const Vector3D &v) const { return Point(x - v.x, y - v.y, z - v.z); }    // point - vector
+
+    bool operator==(const Point &p) const { return fequal(x, p.x) && fequal(y, p.y) && fequal(z, p.z); } // equal operator
+    bool operator!=(const Point &p) const { return !(*this == p); }                                     // non-equal operator
+
+    static float distance(const Point &p1, const Point &p2) { return (p2 - p1).magnitude(); }
+
+    float4 load() const { return float4(x, y, z); }
+};
+
+class Ray {
+public:
+    static constexpr float offset = 0.0001f;
+
+public:
+    Point start;
+    Vector3D dir;
 
-    Vector3D operator-(const Point &p) const; // point - point
-    Point operator-(const Vector3D &v) const; // point - vector
+    Ray() = default;
+    Ray(const Point &p, const Vector3D &v) : start(p), dir(v.normalized()) {}
+    Ray(const Ray &) = default;
+    Ray &operator=(const Ray &) = default;
 
-    bool operator==(const Point &p) const; // equal operator
-    bool operator!=(const Point &p) const; // non-equal operator
+    // 1 / dir, with zero components clamped to a huge value
+    Vector3D invDir() const {
+        auto inv = [](float d) { return std::abs(d) > 1e-20f ? 1 / d : std::copysign(1e20f, d); };
+        return Vector3D(inv(dir.x), inv(dir.y), inv(dir.z));
+    }
+};
 
-    static float distance(const Point &p1, const Point &p2);
+// axis aligned bounding box
+class AABB {
+public:
+    Vector3D min;
+    Vector3D max;
+
+    // construct an empty box, expanding it with anything gives that thing's bounds
+    constexpr AABB() : min(FLOAT_MAX, FLOAT_MAX, FLOAT_MAX), max(-FLOAT_MAX, -FLOAT_MAX, -FLOAT_MAX) {}
+    constexpr AABB(const Vector3D &min, const Vector3D &max) : min(min), max(max) {}
+    constexpr AABB(const AABB &) = default;
+    constexpr AABB &operator=(const AABB &) = default;
+
+    // grow to contain the point
+    void expand(const Point &p) {
+        min = Vector3D(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+        max = Vector3D(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+    }
+    // grow to contain the box
+    void expand(const AABB &box) {
+        min = Vector3D(std::min(min.x, box.min.x), std::min(min.y, box.min.y), std::min(min.z, box.min.z));
+        max = Vector3D(std::max(max.x, box.max.x), std::max(max.y, box.max.y), std::max(max.z, box.max.z));
+    }
+
+    constexpr Vector3D centroid() const { return (min + max) * 0.5f; }
+    constexpr float surfaceArea() const {
+        if (empty()) return 0;
+        Vector3D d = max - min;
+        return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+    constexpr bool empty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+    // inside or on the boundary
+    constexpr bool contains(const Point &p) const {
+        return p.x >= min.x && p.x <= max.x && p.y >= min.y && p.y <= max.y && p.z >= min.z && p.z <= max.z;
+    }
+
+    // slab test, inv_dir is 1 / ray.dir, return the entry distance or -1 if missed in [0, t_max]
+    float intersection(const Ray &ray, const Vector3D &inv_dir, float t_max) const {
+        float tx1 = (min.x - ray.start.x) * inv_dir.x, tx2 = (max.x - ray.start.x) * inv_dir.x;
+        float ty1 = (min.y - ray.start.y) * inv_dir.y, ty2 = (max.y - ray.start.y) * inv_dir.y;
+        float tz1 = (min.z - ray.start.z) * inv_dir.z, tz2 = (max.z - ray.start.z) * inv_dir.z;
+
+        float t_enter = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::max(std::min(tz1, tz2), 0.0f));
+        float t_exit = std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::min(std::max(tz1, tz2), t_max));
+        return t_enter <= t_exit ? t_enter : -1;
+    }
 };
 
 class Face {
@@ -124,20 +199,31 @@ public:
     Vector3D normal();
 };
 
-class Ray {
+// triangle with precomputed edges and normal, for the Möller–Trumbore test
+class Triangle {
 public:
-    static constexpr float offset = 0.0001f;
+    Vector3D v0;
+    Vector3D e1; // v1 - v0
+    Vector3D e2; // v2 - v0
+    Vector3D n;  // normalized cross(e1, e2), same as Face::normal
+
+    Triangle() = default;
+    Triangle(const Point &a, const Point &b, const Point &c);
+    Triangle(const Triangle &) = default;
+    Triangle &operator=(const Triangle &) = default;
+
+    bool degenerate() const; // zero area, has no normal
+    AABB bounds() const;
+};
 
-public:
-    Point start;
-    Vector3D dir;
+// a ray hit, plain data so it is cheap to copy around the render loop, t < 0 means no hit
+struct Hit {
+    Point point;
+    Vector3D normal;
+    float t = -1;
+    int object = -1; // index of the hit object in Scene::object_list, filled in by the scene
 
-    Ray() = default;
-    Ray(const Point &p, const Vector3D &v) : start(p), dir(v.normalized()) {}
-    Ray(const Ray &) = default;
-    Ray &operator=(const Ray &) = default;
+    bool missed() const { return t < 0; }
 };
 
-using Hit = std::tuple<Point, Vector3D, float>;
-
 #endif // _BASIC_H
\ No newline at end of file
@@ -0,0 +1,64 @@
+#ifndef _BUFFER_H
+#define _BUFFER_H
+
+#include <vector>
+#include <cstddef>
+#include <cassert>
+
+// read-mostly array that either owns its elements or borrows them, e.g. from a memory mapped file
+template <typename T>
+class Buffer {
+public:
+    Buffer() = default;
+    Buffer(std::vector<T> &&v) : owned(std::move(v)), ptr(owned.data()), len(owned.size()) {}
+    Buffer(const Buffer &b) { *this = b; }
+    Buffer(Buffer &&b) noexcept { *this = std::move(b); }
+
+    Buffer &operator=(const Buffer &b) {
+        if (this == &b) return *this;
+        owned = b.owned;
+        ptr = b.borrowed() ? b.ptr : owned.data();
+        len = b.len;
+        return *this;
+    }
+
+    Buffer &operator=(Buffer &&b) noexcept {
+        bool was_borrowed = b.borrowed();
+        owned = std::move(b.owned);
+        ptr = was_borrowed ? b.ptr : owned.data();
+        len = b.len;
+        b.ptr = nullptr;
+        b.len = 0;
+        return *this;
+    }
+
+    // the memory must outlive the buffer and every copy of it
+    static Buffer borrow(const T *p, size_t n) {
+        Buffer b;
+        b.ptr = p;
+        b.len = n;
+        return b;
+    }
+
+    bool borrowed() const { return ptr != nullptr && ptr != owned.data(); }
+
+    const T &operator[](size_t i) const { return ptr[i]; }
+    const T *data() const { return ptr; }
+    const T *begin() const { return ptr; }
+    const T *end() const { return ptr + len; }
+    size_t size() const { return len; }
+    bool empty() const { return len == 0; }
+
+    // write access, only for owned elements
+    T *mutableData() {
+        assert(!borrowed());
+        return owned.data();
+    }
+
+private:
+    std::vector<T> owned;
+    const T *ptr = nullptr;
+    size_t len = 0;
+};
+
+#endif // _BUFFER_H
@@ -0,0 +1,235 @@
+#ifndef _BVH_H
+#define _BVH_H
+
+#include <vector>
+#include "basic.h"
+#include "buffer.h"
+#include "packet.h"
+#include "stats.h"
+
+// bounding volume hierarchy over a set of primitive boxes, built with binned SAH or as a morton code LBVH
+class BVH {
+public:
+    enum Builder {
+        binned_sah, // best trees, the top levels are binned in parallel and the subtrees below them built as tasks
+        lbvh,       // primitives sorted along a morton curve and split where the codes differ (Karras 2012),
+                    // several times faster to build, the trees cost more to trace
+    };
+
+    static constexpr int bins = 12;         // number of SAH bins per axis
+    static constexpr int max_leaf = 4;      // leaves larger than this are always split if possible
+    static constexpr int stack_size = 64;   // traversal stack, also limits the depth of the tree
+    static constexpr float traversal_cost = 1.0f; // cost of visiting a node relative to one primitive test
+
+    struct Node {
+        AABB box;
+        int first; // first child if count == 0, otherwise first primitive in index
+        int count; // number of primitives, 0 means interior node
+    };
+
+public:
+    Buffer<Node> nodes;
+    Buffer<int> index; // primitive indices, leaves refer to ranges of it
+
+    // threads: 0 means std::thread::hardware_concurrency(), small inputs are always built on the caller
+    void build(const std::vector<AABB> &boxes, Builder builder = binned_sah, int threads = 1);
+
+    // new boxes for the same primitives, keep the tree and recompute node bounds bottom-up.
+    // much cheaper than build() but the tree gets worse the further primitives move from where it was built
+    void refit(const std::vector<AABB> &boxes);
+
+    bool empty() const { return nodes.empty(); }
+
+    /**
+     *  tree quality, the SAH estimate of the cost of a ray through it, in primitive tests:
+     *  sum(interior) traversal_cost * A(node) / A(root) + sum(leaves) N(leaf) * A(leaf) / A(root)
+     */
+    float sahCost() const;
+
+    // 30 bit morton code of p on a 1024^3 grid over box, points outside are clamped to it
+    static uint32_t morton(const Point &p, const AABB &box);
+
+    // closest hit traversal, func(prim) tests a primitive and shrinks t_max when it finds a closer hit
+    template <typename Func>
+    void traverse(const Ray &ray, float &t_max, Func &&func) const;
+
+    // any hit traversal, stop as soon as func(prim) returns true
+    template <typename Func>
+    bool occluded(const Ray &ray, float t_max, Func &&func) const;
+
+    // packet closest hit traversal, t_max is per lane (< 0 for inactive lanes) and func(prim) shrinks it
+    template <typename Func>
+    void traverse(const RayPacket &packet, float *t_max, Func &&func) const;
+
+    // packet any hit traversal over the active lanes, func(prim, active) returns the lanes it found blocked
+    template <typename Func>
+    unsigned occluded(const RayPacket &packet, const float *t_max, unsigned active, Func &&func) const;
+
+    // func(prim) for every primitive whose leaf box contains the point
+    template <typename Func>
+    void query(const Point &p, Func &&func) const;
+};
+
+template <typename Func>
+void BVH::traverse(const Ray &ray, float &t_max, Func &&func) const {
+    if (nodes.empty()) return;
+
+    Vector3D inv_dir = ray.invDir();
+    std::pair<int, float> stack[stack_size]; // node and its entry distance
+    int top = 0;
+
+    float t_root = nodes[0].box.intersection(ray, inv_dir, t_max);
+    if (t_root < 0) return;
+    stack[top++] = {0, t_root};
+
+    while (top > 0) {
+        auto [current, t_enter] = stack[--top];
+
+        // a closer hit may have been found since the node was pushed
+        if (t_enter > t_max) continue;
+
+        const Node &node = nodes[current];
+        RT_COUNT(bvh_nodes, 1);
+        if (node.count > 0) {
+            for (int i = node.first; i < node.first + node.count; i++) func(index[i]);
+            continue;
+        }
+
+        // visit the nearer child first, so the farther one can be culled by its hits
+        int near = node.first, far = node.first + 1;
+        float t_near = nodes[near].box.intersection(ray, inv_dir, t_max);
+        float t_far = nodes[far].box.intersection(ray, inv_dir, t_max);
+        if (t_near < 0 || (t_far >= 0 && t_far < t_near)) {
+            std::swap(near, far);
+            std::swap(t_near, t_far);
+        }
+
+        if (t_far >= 0) stack[top++] = {far, t_far};
+        if (t_near >= 0) stack[top++] = {near, t_near};
+    }
+}
+
+template <typename Func>
+bool BVH::occluded(const Ray &ray, float t_max, Func &&func) const {
+    if (nodes.empty()) return false;
+
+    Vector3D inv_dir = ray.invDir();
+    int stack[stack_size];
+    int top = 0;
+    stack[top++] = 0;
+
+    // order doesn't matter here, any blocker ends the query
+    while (top > 0) {
+        const Node &node = nodes[stack[--top]];
+        RT_COUNT(bvh_nodes, 1);
+        if (node.box.intersection(ray, inv_dir, t_max) < 0) continue;
+
+        if (node.count > 0) {
+            for (int i = node.first; i < node.first + node.count; i++) {
+                if (func(index[i])) return true;
+            }
+            continue;
+        }
+
+        stack[top++] = node.first + 1;
+        stack[top++] = node.first;
+    }
+
+    return false;
+}
+
+template <typename Func>
+void BVH::traverse(const RayPacket &packet, float *t_max, Func &&func) const {
+    if (nodes.empty()) return;
+
+    alignas(32) float t_enter[RayPacket::size];
+    std::pair<int, float> stack[stack_size]; // node and the smallest entry distance among its lanes
+    int top = 0;
+
+    unsigned mask = boxIntersection(nodes[0].box, packet, t_max, t_enter);
+    if (!mask) return;
+    stack[top++] = {0, minLanes(t_enter, mask)};
+
+    while (top > 0) {
+        auto [current, entry] = stack[--top];
+
+        // every lane may have found a closer hit since the node was pushed
+        if (entry > maxLanes(t_max, RayPacket::all)) continue;
+
+        const Node &node = nodes[current];
+        RT_COUNT(bvh_nodes, 1);
+        if (node.count > 0) {
+            for (int i = node.first; i < node.first + node.count; i++) func(index[i]);
+            continue;
+        }
+
+        int near = node.first, far = node.first + 1;
+        unsigned near_mask = boxIntersection(nodes[near].box, packet, t_max, t_enter);
+        float t_near = minLanes(t_enter, near_mask);
+        unsigned far_mask = boxIntersection(nodes[far].box, packet, t_max, t_enter);
+        float t_far = minLanes(t_enter, far_mask);
+        if (!near_mask || (far_mask && t_far < t_near)) {
+            std::swap(near, far);
+            std::swap(near_mask, far_mask);
+            std::swap(t_near, t_far);
+        }
+
+        if (far_mask) stack[top++] = {far, t_far};
+        if (near_mask) stack[top++] = {near, t_near};
+    }
+}
+
+template <typename Func>
+unsigned BVH::occluded(const RayPacket &packet, const float *t_max, unsigned active, Func &&func) const {
+    if (nodes.empty()) return 0;
+
+    alignas(32) float t_enter[RayPacket::size];
+    unsigned blocked = 0;
+    int stack[stack_size];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0 && blocked != active) {
+        const Node &node = nodes[stack[--top]];
+        RT_COUNT(bvh_nodes, 1);
+        unsigned mask = boxIntersection(node.box, packet, t_max, t_enter) & active & ~blocked;
+        if (!mask) continue;
+
+        if (node.count > 0) {
+            for (int i = node.first; i < node.first + node.count && blocked != active; i++) {
+                blocked |= func(index[i], active & ~blocked);
+            }
+            continue;
+        }
+
+        stack[top++] = node.first + 1;
+        stack[top++] = node.first;
+    }
+
+    return blocked;
+}
+
+template <typename Func>
+void BVH::query(const Point &p, Func &&func) const {
+    if (nodes.empty()) return;
+
+    int stack[stack_size];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        const Node &node = nodes[stack[--top]];
+        RT_COUNT(bvh_nodes, 1);
+        if (!node.box.contains(p)) continue;
+
+        if (node.count > 0) {
+            for (int i = node.first; i < node.first + node.count; i++) func(index[i]);
+            continue;
+        }
+
+        stack[top++] = node.first + 1;
+        stack[top++] = node.first;
+    }
+}
+
+#endif // _BVH_H
@@ -0,0 +1,115 @@
+#ifndef _FLOAT4_H
+#define _FLOAT4_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FLOAT4_SSE
+#endif
+
+// 4 floats in one 16 byte aligned register, sse when available, plain floats otherwise
+// used for x, y, z (w unused) math in the scalar paths, the wide kernels are in packet.h
+struct alignas(16) float4 {
+#ifdef FLOAT4_SSE
+    __m128 v;
+
+    float4() : v(_mm_setzero_ps()) {}
+    float4(__m128 v) : v(v) {}
+    explicit float4(float s) : v(_mm_set1_ps(s)) {}
+    float4(float x, float y, float z, float w = 0) : v(_mm_setr_ps(x, y, z, w)) {}
+
+    // 4 unsigned bytes, e.g. quantized box bounds
+    static float4 fromBytes(const uint8_t *b) {
+        int32_t bytes;
+        std::memcpy(&bytes, b, 4);
+        __m128i i = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), _mm_setzero_si128());
+        return _mm_cvtepi32_ps(_mm_unpacklo_epi16(i, _mm_setzero_si128()));
+    }
+
+    float operator[](int i) const {
+        alignas(16) float f[4];
+        _mm_store_ps(f, v);
+        return f[i];
+    }
+    void store(float *f) const { _mm_storeu_ps(f, v); }
+
+    float4 operator+(const float4 &b) const { return _mm_add_ps(v, b.v); }
+    float4 operator-(const float4 &b) const { return _mm_sub_ps(v, b.v); }
+    float4 operator*(const float4 &b) const { return _mm_mul_ps(v, b.v); }
+    float4 operator/(const float4 &b) const { return _mm_div_ps(v, b.v); }
+
+    // largest / smallest of x, y, z
+    float max3() const {
+        __m128 m = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 2, 1)));
+        return _mm_cvtss_f32(_mm_max_ss(m, _mm_movehl_ps(v, v)));
+    }
+    float min3() const {
+        __m128 m = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 2, 1)));
+        return _mm_cvtss_f32(_mm_min_ss(m, _mm_movehl_ps(v, v)));
+    }
+#else
+    float v[4];
+
+    float4() : v{0, 0, 0, 0} {}
+    explicit float4(float s) : v{s, s, s, s} {}
+    float4(float x, float y, float z, float w = 0) : v{x, y, z, w} {}
+
+    static float4 fromBytes(const uint8_t *b) { return float4(b[0], b[1], b[2], b[3]); }
+
+    float operator[](int i) const { return v[i]; }
+    void store(float *f) const { std::copy(v, v + 4, f); }
+
+    float4 operator+(const float4 &b) const { return float4(v[0] + b.v[0], v[1] + b.v[1], v[2] + b.v[2], v[3] + b.v[3]); }
+    float4 operator-(const float4 &b) const { return float4(v[0] - b.v[0], v[1] - b.v[1], v[2] - b.v[2], v[3] - b.v[3]); }
+    float4 operator*(const float4 &b) const { return float4(v[0] * b.v[0], v[1] * b.v[1], v[2] * b.v[2], v[3] * b.v[3]); }
+    float4 operator/(const float4 &b) const { return float4(v[0] / b.v[0], v[1] / b.v[1], v[2] / b.v[2], v[3] / b.v[3]); }
+
+    float max3() const { return std::max(std::max(v[0], v[1]), v[2]); }
+    float min3() const { return std::min(std::min(v[0], v[1]), v[2]); }
+#endif
+};
+
+// per component min / max
+inline float4 vmin(const float4 &a, const float4 &b) {
+#ifdef FLOAT4_SSE
+    return _mm_min_ps(a.v, b.v);
+#else
+    return float4(std::min(a.v[0], b.v[0]), std::min(a.v[1], b.v[1]), std::min(a.v[2], b.v[2]), std::min(a.v[3], b.v[3]));
+#endif
+}
+
+inline float4 vmax(const float4 &a, const float4 &b) {
+#ifdef FLOAT4_SSE
+    return _mm_max_ps(a.v, b.v);
+#else
+    return float4(std::max(a.v[0], b.v[0]), std::max(a.v[1], b.v[1]), std::max(a.v[2], b.v[2]), std::max(a.v[3], b.v[3]));
+#endif
+}
+
+// bit i is set when a[i] <= b[i]
+inline int lessEqual(const float4 &a, const float4 &b) {
+#ifdef FLOAT4_SSE
+    return _mm_movemask_ps(_mm_cmple_ps(a.v, b.v));
+#else
+    return (a.v[0] <= b.v[0]) | (a.v[1] <= b.v[1]) << 1 | (a.v[2] <= b.v[2]) << 2 | (a.v[3] <= b.v[3]) << 3;
+#endif
+}
+
+/**
+ *  1 / sqrt(x) from the hardware estimate (12 bits) and one newton step:
+ *  r' = r * (1.5 - 0.5 * x * r^2), about 22 bits, enough for directions and normals
+ */
+inline float rsqrt(float x) {
+#ifdef FLOAT4_SSE
+    float r = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+    return r * (1.5f - 0.5f * x * r * r);
+#else
+    return 1 / std::sqrt(x);
+#endif
+}
+
+#endif // _FLOAT4_H
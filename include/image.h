@@ -0,0 +1,15 @@
+#ifndef _IMAGE_H
+#define _IMAGE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// writers for the rgb8 buffers filled by Scene::render, rows are stored bottom-up like glDrawPixels
+bool writePPM(const std::string &path, const unsigned char *pixel, int width, int height);
+bool writePNG(const std::string &path, const unsigned char *pixel, int width, int height);
+
+// pick the format from the extension (.ppm or .png)
+bool writeImage(const std::string &path, const unsigned char *pixel, int width, int height);
+
+#endif // _IMAGE_H
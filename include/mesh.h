@@ -3,10 +3,30 @@
 
 #include "basic.h"
 #include "obj.h"
+#include "bvh.h"
+#include "wide_bvh.h"
+#include "packet.h"
+#include "buffer.h"
+#include "mapped_file.h"
+#include "transform.h"
 
 class Mesh {
 public:
     virtual Hit intersection(const Ray &) = 0;
+    virtual bool occluded(const Ray &, float t_min, float t_max) = 0; // any hit in [t_min, t_max)
+
+    // packet versions, return the lanes whose hit got closer / the active lanes that are blocked
+    // the defaults trace the lanes one by one
+    virtual unsigned intersection(const RayPacket &packet, PacketHit &hit);
+    virtual unsigned occluded(const RayPacket &packet, float t_min, const float *t_max, unsigned active);
+
+    // for the scene's occluder cache: occluded() that also names the part that blocked the ray (per lane for
+    // packets), a triangle of a model or -1 for meshes without parts, and the test of one such part alone
+    virtual bool occluded(const Ray &ray, float t_min, float t_max, int &part);
+    virtual unsigned occluded(const RayPacket &packet, float t_min, const float *t_max, unsigned active, int *part);
+    virtual bool partOccluded(int part, const Ray &ray, float t_min, float t_max);
+
+    virtual AABB bounds() const = 0;
 };
 
 class Sphere : public Mesh {
@@ -19,6 +39,10 @@ public:
     Sphere &operator=(const Sphere &) = default;
 
     Hit intersection(const Ray &ray) override;
+    bool occluded(const Ray &ray, float t_min, float t_max) override;
+    unsigned intersection(const RayPacket &packet, PacketHit &hit) override;
+    unsigned occluded(const RayPacket &packet, float t_min, const float *t_max, unsigned active) override;
+    AABB bounds() const override;
 };
 
 class Plane : public Mesh {
@@ -32,17 +56,79 @@ public:
     Plane &operator=(const Plane &) = default;
 
     Hit intersection(const Ray &ray) override;
+    bool occluded(const Ray &ray, float t_min, float t_max) override;
+    unsigned intersection(const RayPacket &packet, PacketHit &hit) override;
+    unsigned occluded(const RayPacket &packet, float t_min, const float *t_max, unsigned active) override;
+    AABB bounds() const override;
 };
 
 // other polygon mesh model
 class Model : public Mesh {
 public:
-    std::vector<Face> face;
+    std::vector<Point> vertex;      // indexed vertex buffer
+    std::vector<int> index;         // vertex indices, three per triangle
+    Buffer<Triangle> triangle;      // precomputed from vertex and index by build(), in bvh leaf order
+    BVH bvh;
+
+    // set when triangle and bvh borrow a mapped mesh file (see mesh_file.h), vertex and index are empty then
+    std::shared_ptr<MappedFile> mapping;
+
+    // how build() makes the bvh, threads 0 means std::thread::hardware_concurrency()
+    BVH::Builder builder = BVH::binned_sah;
+    int build_threads = 0;
+
+    // compact layout: build() converts bvh and triangle into wide, then empties them. a third of the memory
+    // and far fewer cache lines per ray, packets are traced lane by lane and it can't be saved to a mesh file
+    bool compact = false;
+    WideBVH wide;
 
     Model() = default;
-    Model(const OBJ &obj) : face(obj.face) {}
+    Model(const OBJ &obj, BVH::Builder b = BVH::binned_sah) : vertex(obj.vertex), index(obj.triangle), builder(b) { build(); }
+
+    void addFace(const Face &f); // fan triangulate a polygon into the buffers, call build() afterwards
+    void build();
+
+    size_t geometryBytes() const; // memory of the structures tracing reads, bvh and triangles or wide
 
     Hit intersection(const Ray &ray) override;
+    bool occluded(const Ray &ray, float t_min, float t_max) override;
+    unsigned intersection(const RayPacket &packet, PacketHit &hit) override;
+    unsigned occluded(const RayPacket &packet, float t_min, const float *t_max, unsigned active) override;
+    bool occluded(const Ray &ray, float t_min, float t_max, int &part) override;
+    unsigned occluded(const RayPacket &packet, float t_min, const float *t_max, unsigned active, int *part) override;
+    bool partOccluded(int part, const Ray &ray, float t_min, float t_max) override; // part is a position in triangle
+    AABB bounds() const override;
+};
+
+// a shared mesh placed by an affine transform, rays are moved into the mesh's space instead of copying its
+// geometry, so a model and its bvh are stored once however many instances the scene has
+class Instance : public Mesh {
+public:
+    std::shared_ptr<Mesh> mesh;
+    Transform transform; // mesh space to world
+    Transform inverse;   // world to mesh space
+
+    Instance(std::shared_ptr<Mesh> m, const Transform &t) : mesh(m), transform(t), inverse(t.inverse()) {}
+
+    // move the instance, then report it with Scene::moved()
+    void setTransform(const Transform &t) {
+        transform = t;
+        inverse = t.inverse();
+    }
+
+    Hit intersection(const Ray &ray) override;
+    bool occluded(const Ray &ray, float t_min, float t_max) override;
+    unsigned intersection(const RayPacket &packet, PacketHit &hit) override;
+    unsigned occluded(const RayPacket &packet, float t_min, const float *t_max, unsigned active) override;
+    bool occluded(const Ray &ray, float t_min, float t_max, int &part) override;
+    unsigned occluded(const RayPacket &packet, float t_min, const float *t_max, unsigned active, int *part) override;
+    bool partOccluded(int part, const Ray &ray, float t_min, float t_max) override; // parts of the shared mesh
+    AABB bounds() const override;
+
+private:
+    // the ray in mesh space with a normalized direction, scale turns world distances into mesh space ones
+    Ray toMesh(const Ray &ray, float &scale) const;
+    RayPacket toMesh(const RayPacket &packet, float *scale) const;
 };
 
 #endif // _MESH_H
\ No newline at end of file
@@ -0,0 +1,38 @@
+#ifndef _MESH_FILE_H
+#define _MESH_FILE_H
+
+#include <memory>
+#include <string>
+#include <cstdint>
+#include "mesh.h"
+
+/**
+ *  binary mesh file (.rtm): a processed Model with its bvh, loaded by mapping the file
+ *
+ *  [header][triangles][bvh nodes][bvh index], every array starts at a 64 byte aligned offset,
+ *  the element sizes are recorded so files from an incompatible build are rejected
+ */
+struct MeshFileHeader {
+    static constexpr char magic_value[8] = {'R', 'T', 'M', 'E', 'S', 'H', '\0', '\0'};
+    static constexpr uint32_t current_version = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;        // 0x01020304 written natively
+    uint32_t triangle_size; // sizeof(Triangle)
+    uint32_t node_size;     // sizeof(BVH::Node)
+    uint64_t triangle_count;
+    uint64_t triangle_offset;
+    uint64_t node_count;
+    uint64_t node_offset;
+    uint64_t index_count;
+    uint64_t index_offset;
+};
+
+// false for compact models, the file holds the binary bvh and triangles
+bool saveModel(const Model &model, const std::string &path);
+
+// zero-copy, the returned model borrows the mapped file, nullptr on failure
+std::shared_ptr<Model> loadModel(const std::string &path);
+
+#endif // _MESH_FILE_H
@@ -2,18 +2,32 @@
 #define _OBJ_H
 
 #include <iostream>
-#include <sstream>
-#include <fstream>
 #include <vector>
 #include <string>
 #include "basic.h"
 
 class OBJ {
+public:
+    // a run of triangles sharing the same object / group name and material
+    struct Group {
+        std::string name;     // from o or g
+        std::string material; // from usemtl
+        int first;            // first triangle
+        int count;
+    };
+
 public:
     std::vector<Point> vertex;
-    std::vector<Face> face;
+    std::vector<Vector3D> normal;
+    std::vector<float> texcoord; // u, v pairs
+
+    std::vector<int> triangle;          // vertex indices, three per triangle, polygons are fan triangulated
+    std::vector<int> triangle_texcoord; // texcoord index of every corner, -1 if the face has none
+    std::vector<int> triangle_normal;   // normal index of every corner, -1 if the face has none
+    std::vector<Group> group;
 
-    OBJ(std::string path, float x_offs = 0, float y_offs = 0, float z_offs = 0, float scale = 1);
+    // the file is memory mapped, threads > 1 parses large files in parallel chunks
+    OBJ(std::string path, float x_offs = 0, float y_offs = 0, float z_offs = 0, float scale = 1, int threads = 1);
 };
 
-#endif // _OBJ_H
\ No newline at end of file
+#endif // _OBJ_H
@@ -10,6 +10,9 @@
 #include "basic.h"
 #include "renderer.h"
 #include "mesh.h"
+#include "bvh.h"
+#include "primitives.h"
+#include "thread_pool.h"
 
 // object
 class Object {
@@ -18,8 +21,6 @@ public:
     Renderer mesh_renderer;
 };
 
-using HitInfo = std::pair<Hit, std::shared_ptr<Object>>;
-
 class Scene;
 
 // light
@@ -34,23 +35,50 @@ public:
 
     void setParentScene(std::shared_ptr<Scene> scene);
 
-    virtual Vector3D getColor(const Hit &hit, std::shared_ptr<Object> hit_object, const Vector3D &V) = 0;
+    virtual Vector3D getColor(const Hit &hit, const Material &material, const Vector3D &V) const = 0;
+
+    // getColor split in two, so shadow rays can be traced in batches:
+    // shadowRay builds the ray towards the light (false if the light can't reach the point anyway),
+    // getLitColor is the color when nothing blocks that ray
+    virtual bool shadowRay(const Hit &hit, const Vector3D &V, Ray &ray, float &t_max) const = 0;
+    virtual Vector3D getLitColor(const Hit &hit, const Material &material, const Vector3D &V) const = 0;
+
+    // for many-light sampling: a cheap estimate of the unshadowed contribution, it must be > 0
+    // wherever getLitColor can be non-zero
+    virtual float importance(const Hit &hit) const = 0;
+
+    // the box outside of which the light adds nothing, false if it reaches everywhere
+    virtual bool bounds(AABB &box) const { return false; }
 };
 
 class AmbientLight : public Light {
 public:
     AmbientLight(const Vector3D &i) : Light(i) {}
 
-    Vector3D getColor(const Hit &hit, std::shared_ptr<Object> hit_object, const Vector3D &V) override;
+    Vector3D getColor(const Hit &hit, const Material &material, const Vector3D &V) const override;
+    bool shadowRay(const Hit &hit, const Vector3D &V, Ray &ray, float &t_max) const override; // t_max = 0, never blocked
+    Vector3D getLitColor(const Hit &hit, const Material &material, const Vector3D &V) const override;
+    float importance(const Hit &hit) const override;
 };
 
 class PointLight : public Light {
 public:
     Point position;
+    float radius; // attenuation radius, the light fades out smoothly and is culled beyond it. 0 reaches everywhere
+
+    PointLight(const Vector3D &i, const Point &p, float r = 0) : Light(i), position(p), radius(r) {}
 
-    PointLight(const Vector3D &i, const Point &p) : Light(i), position(p) {}
+    Vector3D getColor(const Hit &hit, const Material &material, const Vector3D &V) const override;
+    bool shadowRay(const Hit &hit, const Vector3D &V, Ray &ray, float &t_max) const override;
+    Vector3D getLitColor(const Hit &hit, const Material &material, const Vector3D &V) const override;
+    float importance(const Hit &hit) const override;
+    bool bounds(AABB &box) const override;
 
-    Vector3D getColor(const Hit &hit, std::shared_ptr<Object> hit_object, const Vector3D &V) override;
+    /**
+     *  window of the attenuation radius r, 1 at the light and 0 from r on
+     *  (1 - (d / r)^2)^2
+     */
+    float attenuation(float d) const;
 };
 
 // camera
@@ -71,12 +99,13 @@ public:
     void setPerspective(int windowWidth, int windowHeight);
 
     Ray getRay(int x, int y, int windowWidth, int windowHeight);
+    Ray getRay(float x, float y, int windowWidth, int windowHeight); // sub-pixel position, pixel centers are integers
 };
 
 // scene
 class Scene : public std::enable_shared_from_this<Scene> {
 public:
-    static constexpr int maxdepth = 5;
+    static constexpr int tile_size = 16; // tiles are the unit of work handed to render threads
 
 public:
     std::unordered_set<std::shared_ptr<Object>> objects;
@@ -86,6 +115,66 @@ public:
 
     Vector3D background;
 
+    int max_depth = 5; // bounces after the camera ray, deeper rays are black
+
+    // a secondary ray that can add less than min_contribution to its pixel plays russian roulette:
+    // it survives with probability contribution / min_contribution and is scaled up by the inverse, so the
+    // average stays the same. without roulette those rays are just cut, deterministic but slightly darker
+    float min_contribution = 1.0f / 255;
+    bool roulette = true;
+
+    // adaptive anti-aliasing in render(): every pixel gets aa_min_samples (1 is the pixel center), then pixels
+    // whose color differs from a neighbor's, or whose own samples differ, by more than aa_threshold in any
+    // channel are traced again with aa_max_samples jittered stratified samples. aa_max_samples = 1 turns it off
+    int aa_min_samples = 1;
+    int aa_max_samples = 16;
+    float aa_threshold = 0.1f;
+    int64_t last_samples = 0; // camera rays traced by the last render()
+
+    // incremental rendering: render() keeps the colors and primary hits of its frame, and the next frame only
+    // traces the pixels a reported change can reach. report moved objects with moved() and edited lights or
+    // materials with relit(). a new camera, window size or render setting, or adding / removing objects or
+    // lights, renders the whole frame. needs aa_min_samples == 1, the kept hit is the pixel center's
+    bool incremental = false;
+
+    bool packets = true; // trace primary rays and their shadow rays in packets
+    bool wavefront = true; // trace bounce by bounce over ray queues instead of recursing, see wavefront.h
+    bool sort_rays = false; // the wavefront engine sorts secondary rays by direction and origin before tracing them
+
+    // a shadow ray first tests the primitive (triangle, sphere, plane) that blocked the previous shadow ray of
+    // the same light on the same thread, and only traverses the bvh when that one doesn't block it. neighboring
+    // points are mostly shadowed by the same one. RT_STATS builds count the rays it blocks as occluder_hits
+    bool occluder_cache = true;
+
+    int threads = 0; // render threads, 0 means std::thread::hardware_concurrency()
+    std::shared_ptr<ThreadPool> pool; // kept across frames, recreated when threads changes
+
+    // top level acceleration structure over the bounds of objects, rebuilt when objects are added or removed,
+    // refit when they move. spheres and planes are packed into clusters of primitives, the bvh holds the
+    // clusters and the other objects
+    std::vector<std::shared_ptr<Object>> object_list;
+    BVH bvh;
+    std::vector<int> bvh_entry; // primitive i of the bvh: an index in object_list, or ~cluster
+    PrimitiveGroup primitives;  // the SoA data is refreshed by compile()
+    bool dirty = false; // objects or lights were added or removed since the last build
+
+    // the scene compiled for rendering: flat arrays indexed by object / material id, refreshed every frame by
+    // prepare(). tracing only reads these, so it never copies a shared_ptr (an atomic shared by all threads)
+    std::vector<Mesh *> mesh_list;      // mesh of object_list[i]
+    std::vector<int> material_id;       // material of object_list[i], index in material_list
+    std::vector<Material> material_list;
+    std::vector<Light *> light_list;    // direct lights, the ambient light is kept apart
+
+    // many lights: lights with bounds are found through light_bvh, the others are always candidates.
+    // when more than light_samples candidates can reach a point, light_samples of them are drawn in
+    // proportion to Light::importance and weighted by 1 / (light_samples * probability), so a point
+    // costs at most light_samples shadow rays however many lights the scene has
+    static constexpr int max_light_samples = 16;
+    int light_samples = 4; // [1, max_light_samples]
+    std::vector<int> global_lights;  // lights without bounds, index in light_list
+    std::vector<int> bounded_lights; // primitives of light_bvh, index in light_list
+    BVH light_bvh;
+
     void addObject(std::shared_ptr<Object> object);
 
     void delObject(std::shared_ptr<Object> object);
@@ -94,13 +183,110 @@ public:
 
     void delLight(std::shared_ptr<Light> light);
 
-    HitInfo getIntersection(Ray &ray);
+    void build(); // rebuild the top level bvh
+    void refit(); // refit the top level bvh to the objects reported by moved(), prepare() calls it
+    void compile(); // refresh the flat arrays from objects and lights, build() calls it
+
+    void moved(std::shared_ptr<Object> object); // call after moving or reshaping the mesh of an object
+    void relit(); // call after editing lights or materials, for incremental frames
+
+    const Material &material(const Hit &hit) const { return material_list[material_id[hit.object]]; }
+
+    Hit getIntersection(const Ray &ray); // hit.object is the index in object_list
+    void getIntersection(const RayPacket &packet, PacketHit &hit); // hit.prim is the index in object_list
+
+    // any hit in [t_min, t_max). shadow rays pass the light_list index of their light (per lane for packets),
+    // then the occluder cache is tried first, see occluder_cache
+    bool occluded(const Ray &ray, float t_min, float t_max, int light = -1);
+    unsigned occluded(const RayPacket &packet, float t_min, const float *t_max, unsigned active, const int *light = nullptr);
 
-    bool underShadow(Ray &ray, float t_max);
+    bool underShadow(const Ray &ray, float t_max, int light = -1);
 
-    Vector3D rayTrace(Ray &ray, int depth);
+    // pick the lights to shade a hit with, write their light_list indices and weights, return how many.
+    // at most max_light_samples, each one at most once
+    int selectLights(const Hit &hit, int *light, float *weight) const;
+
+    Vector3D localColor(const Hit &hit, const Vector3D &V); // ambient and direct lights
+
+    // secondary rays of a hit, reflection first and then refraction, with the share of color each one carries
+    // return how many were written, 0 for rough materials
+    int scatter(const Ray &ray, const Hit &hit, Ray *rays, Vector3D *weights) const;
+
+    // cutoff / roulette for a secondary ray at depth, scattered with weight from a path with throughput,
+    // false if it is dropped, otherwise weight may be scaled up
+    bool survive(const Ray &ray, int depth, const Vector3D &throughput, Vector3D &weight) const;
+
+    // reflection and refraction on top of the local color, throughput is the weight of ray in its pixel
+    Vector3D shade(const Ray &ray, const Hit &hit, int depth, const Vector3D &local, const Vector3D &throughput = Vector3D(1, 1, 1));
+
+    Vector3D rayTrace(const Ray &ray, int depth, const Vector3D &throughput = Vector3D(1, 1, 1));
+    Vector3D rayTrace(const Ray &ray, const Hit &hit); // camera ray whose first hit is already known
+    void rayTrace(const RayPacket &packet, Vector3D *color, Hit *primary = nullptr); // primary rays of a packet
+
+    // set up the camera and acceleration structures for a frame, render() calls it
+    void prepare(int windowWidth, int windowHeight);
+
+    // run func(x0, y0, x1, y1) on every tile of the image, on the thread pool when MULTI_THREADS is set
+    void forEachTile(int windowWidth, int windowHeight, const std::function<void(int, int, int, int)> &func);
+
+    // trace camera rays through the sub-pixel positions (x[i], y[i]), with the wavefront engine or in packets when enabled.
+    // primary, when given, gets the first hit of every camera ray
+    void trace(const float *x, const float *y, int count, int windowWidth, int windowHeight, Vector3D *color, Hit *primary = nullptr);
 
     void render(unsigned char *pixel, int windowWidth, int windowHeight);
+
+private:
+    std::vector<Vector3D> base;       // render(): colors of the base pass
+    std::vector<unsigned char> noisy; // render(): base samples of the pixel disagree
+
+    std::vector<AABB> object_bounds;                    // bounds of object_list[i] at the last build or refit
+    std::vector<AABB> entryBounds() const;              // of the bvh primitives, from object_bounds
+
+    // any hit of bvh primitive e, an object or a cluster. with part, also what blocked the ray: the lane of a
+    // cluster or the part of an object's mesh, see Mesh::partOccluded
+    bool entryOccluded(int e, const Ray &ray, float t_min, float t_max);
+    bool entryOccluded(int e, const Ray &ray, float t_min, float t_max, int &part);
+    unsigned entryOccluded(int e, const RayPacket &packet, float t_min, const float *t_max, unsigned lanes);
+    unsigned entryOccluded(int e, const RayPacket &packet, float t_min, const float *t_max, unsigned lanes, int *part);
+
+    // the occluder cache of the calling thread, what blocked the previous shadow ray of each light, if anything
+    struct Occluder {
+        int entry = -1; // bvh primitive, -1 for none
+        int part = -1;
+    };
+    std::vector<Occluder> &lastOccluders();
+    bool occluded(const Occluder &o, const Ray &ray, float t_min, float t_max); // that one alone
+
+    std::vector<std::shared_ptr<Object>> moved_objects; // reported by moved() since the last refit
+    std::vector<AABB> changed; // old and new bounds of the objects refit since the last render()
+    bool relight = false;      // relit() since the last render()
+
+    // everything a frame's pixels depend on besides the scene contents
+    struct FrameSettings {
+        int width = 0, height = 0;
+        Point eye, center;
+        Vector3D up, background;
+        float fovy = 0;
+        int max_depth = 0, light_samples = 0, aa_min_samples = 0, aa_max_samples = 0;
+        float min_contribution = 0, aa_threshold = 0;
+        bool roulette = false;
+
+        bool operator==(const FrameSettings &) const = default;
+    };
+
+    // the last frame, for incremental render()
+    struct Frame {
+        FrameSettings settings;
+        std::vector<Hit> hit;        // first hit of the pixel center
+        std::vector<Vector3D> color; // final color, empty if the next frame must be rendered in full
+        std::vector<unsigned char> todo;
+    } frame;
+
+    FrameSettings frameSettings(int windowWidth, int windowHeight) const;
+
+    // could a change inside the changed boxes alter a camera ray with this first hit: along the ray itself,
+    // along the shadow rays of the hit, or anywhere at all once it reflects or refracts
+    bool affected(const Ray &ray, const Hit &hit) const;
 };
 
 #endif // _OBJECTS_H
\ No newline at end of file
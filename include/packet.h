@@ -0,0 +1,74 @@
+#ifndef _PACKET_H
+#define _PACKET_H
+
+#include "basic.h"
+
+// simd kernels are cloned for avx2 / plain x86-64 and picked at load time (gcc ifunc)
+// put it on the definitions only, callers just see a normal function
+// no avx512 clone: 8 lanes already fill a 256 bit register, and zmm code lowers the core clock for the shading around it
+#if defined(__GNUC__) && !defined(__clang__) && defined(__linux__) && defined(__x86_64__)
+#define PACKET_KERNEL __attribute__((target_clones("avx2", "default"), optimize("vect-cost-model=dynamic")))
+#else
+#define PACKET_KERNEL
+#endif
+
+// a packet of coherent rays in SoA layout, lanes from count to size are inactive
+class RayPacket {
+public:
+    static constexpr int size = 8;
+    static constexpr unsigned all = (1u << size) - 1;
+
+public:
+    alignas(32) float ox[size], oy[size], oz[size]; // origins
+    alignas(32) float dx[size], dy[size], dz[size]; // normalized directions
+    alignas(32) float ix[size], iy[size], iz[size]; // inverse directions
+    int count = 0;
+
+    void set(int lane, const Ray &ray);
+    Ray get(int lane) const;
+
+    unsigned active() const { return (1u << count) - 1; }
+};
+
+// per lane closest hit, lanes that missed keep t == FLOAT_MAX, inactive lanes have t < 0
+class PacketHit {
+public:
+    alignas(32) float t[RayPacket::size];
+    Vector3D normal[RayPacket::size];
+    int prim[RayPacket::size]; // set by the caller that owns the primitives, e.g. scene object index
+
+    PacketHit(const RayPacket &packet);
+
+    bool hit(int lane) const { return t[lane] >= 0 && t[lane] < FLOAT_MAX; }
+    Hit get(const RayPacket &packet, int lane) const;
+};
+
+// smallest / largest value among the lanes in mask
+inline float minLanes(const float *v, unsigned mask) {
+    float ret = FLOAT_MAX;
+    for (int l = 0; l < RayPacket::size; l++) {
+        if (mask >> l & 1) ret = std::min(ret, v[l]);
+    }
+    return ret;
+}
+
+inline float maxLanes(const float *v, unsigned mask) {
+    float ret = -FLOAT_MAX;
+    for (int l = 0; l < RayPacket::size; l++) {
+        if (mask >> l & 1) ret = std::max(ret, v[l]);
+    }
+    return ret;
+}
+
+/**
+ *  kernels: one primitive against every lane, they write the smallest distance >= t_min
+ *  of each lane into t, or FLOAT_MAX when the lane misses
+ */
+void sphereDistance(const Point &center, float radius, const RayPacket &packet, float t_min, float *t);
+void planeDistance(const Point &lb, const Vector3D &right, const Vector3D &up, const RayPacket &packet, float t_min, float *t);
+void triangleDistance(const Triangle &tri, const RayPacket &packet, float t_min, float *t);
+
+// slab test of every lane against [0, t_max), entry distances go to t_enter, return the mask of lanes that hit
+unsigned boxIntersection(const AABB &box, const RayPacket &packet, const float *t_max, float *t_enter);
+
+#endif // _PACKET_H
@@ -0,0 +1,58 @@
+#ifndef _PRIMITIVES_H
+#define _PRIMITIVES_H
+
+#include "basic.h"
+#include "mesh.h"
+
+// the spheres and planes of a scene packed into clusters of up to 8 of one kind, in SoA layout with what a ray
+// test needs precomputed (squared radii, unit normals, squared edge lengths). a cluster is tested against a ray
+// by one simd kernel instead of a virtual call per primitive
+class PrimitiveGroup {
+public:
+    static constexpr int width = 8;
+
+    struct alignas(32) Spheres {
+        float cx[width], cy[width], cz[width];
+        float r2[width]; // radius^2
+    };
+
+    struct alignas(32) Quads {
+        float ox[width], oy[width], oz[width]; // left bottom corner
+        float nx[width], ny[width], nz[width]; // unit normal, cross(right, up).normalized() as Plane computes it
+        float rx[width], ry[width], rz[width]; // right
+        float ux[width], uy[width], uz[width]; // up
+        float right_len2[width], up_len2[width];
+    };
+
+    struct Cluster {
+        bool quads;         // spheres otherwise
+        int count;          // used lanes, the first ones
+        int data;           // index in spheres or quads
+        int object[width];  // the object of each lane, index in Scene::object_list
+    };
+
+    std::vector<Cluster> clusters;
+    std::vector<Spheres> spheres;
+    std::vector<Quads> quads;
+
+    // Sphere and Plane go into clusters, other meshes (and subclasses) are traced on their own
+    static bool accepts(const Mesh *mesh);
+
+    // cluster the accepted meshes, nearby ones together, meshes and bounds are indexed by object
+    void build(const std::vector<Mesh *> &meshes, const std::vector<AABB> &bounds);
+    // refresh the SoA data from the meshes, which may have moved since build()
+    void update(const std::vector<Mesh *> &meshes);
+
+    AABB bounds(int cluster, const std::vector<AABB> &object_bounds) const;
+
+    // closest hit in [t_min, t_max) among the lanes of a cluster, return the lane (-1 if none) and shrink t_max
+    int intersection(int cluster, const Ray &ray, float t_min, float &t_max) const;
+    bool occluded(int cluster, const Ray &ray, float t_min, float t_max) const;
+    bool occluded(int cluster, int lane, const Ray &ray, float t_min, float t_max) const; // that lane alone
+    Vector3D normal(int cluster, int lane, const Point &p) const; // at a point of the surface
+
+private:
+    void distances(const Cluster &c, const Ray &ray, float t_min, float *t) const; // a kernel over the lanes
+};
+
+#endif // _PRIMITIVES_H
@@ -0,0 +1,56 @@
+#ifndef _PROGRESSIVE_H
+#define _PROGRESSIVE_H
+
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include "basic.h"
+#include "objects.h"
+#include "random.h"
+
+// renders a scene in passes, accumulating jittered samples into a float framebuffer,
+// until a sample or time budget is spent or every pixel has converged
+class ProgressiveRenderer {
+public:
+    static constexpr int preview_strides[] = {16, 4}; // coarse passes shown before the first full pass
+
+public:
+    std::shared_ptr<Scene> scene;
+    int width;
+    int height;
+
+    int min_samples = 4;               // samples before a pixel may be considered converged
+    int max_samples = 64;              // sample budget per pixel
+    double time_budget = 0;            // milliseconds, 0 means no limit
+    float error_threshold = 0.5f / 255; // converged when the standard error of the luminance drops below
+
+    std::vector<Vector3D> sum;     // accumulated color
+    std::vector<float> sum_sqr;    // accumulated squared luminance, for the variance
+    std::vector<int> samples;      // samples taken per pixel
+    std::vector<Vector3D> preview; // coarse colors, shown until a pixel gets its first sample
+    int passes = 0;
+    int converged = 0; // pixels that stopped sampling
+
+    ProgressiveRenderer(std::shared_ptr<Scene> s, int w, int h);
+
+    void reset(); // start over, e.g. after the scene changed
+
+    bool done() const;
+
+    // render the next pass, return false if nothing was left to do
+    bool pass();
+
+    // run passes until done, on_pass is called after every pass to publish intermediate images
+    void run(const std::function<void()> &on_pass = nullptr);
+
+    void resolve(unsigned char *pixel) const; // current estimate as rgb8, rows bottom-up like Scene::render
+
+private:
+    std::chrono::steady_clock::time_point start;
+
+    void previewPass(int stride);
+    void samplePass();
+};
+
+#endif // _PROGRESSIVE_H
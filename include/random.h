@@ -0,0 +1,39 @@
+#ifndef _RANDOM_H
+#define _RANDOM_H
+
+#include <cstdint>
+
+// small pcg32 generator, cheap to seed per pixel and sample so renders are reproducible
+class Random {
+public:
+    uint64_t state;
+
+    Random(uint64_t seed = 0, uint64_t stream = 0) : state(0), inc(stream << 1 | 1) {
+        next();
+        state += seed;
+        next();
+    }
+
+    uint32_t next() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ull + inc;
+        uint32_t xorshifted = ((old >> 18) ^ old) >> 27;
+        uint32_t rot = old >> 59;
+        return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+    }
+
+    float uniform() { return (next() >> 8) * (1.0f / 16777216.0f); } // [0, 1)
+
+    // mix a few integers into one seed
+    static uint64_t hash(uint64_t a, uint64_t b = 0, uint64_t c = 0) {
+        uint64_t h = a * 0x9e3779b97f4a7c15ull ^ (b + 0x632be59bd9b4e019ull) * 0xbf58476d1ce4e5b9ull ^ c * 0x94d049bb133111ebull;
+        h ^= h >> 31;
+        h *= 0xd6e8feb86659fd93ull;
+        return h ^ h >> 32;
+    }
+
+private:
+    uint64_t inc;
+};
+
+#endif // _RANDOM_H
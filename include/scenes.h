@@ -0,0 +1,31 @@
+#ifndef _SCENES_H
+#define _SCENES_H
+
+#include <memory>
+#include <string>
+#include "basic.h"
+#include "mesh.h"
+#include "objects.h"
+#include "obj.h"
+#include "mesh_file.h"
+#include "random.h"
+
+// the demo room: six planes, four spheres and the obj model (or its .rtm file), shared by every frontend
+std::shared_ptr<Scene> createDemoScene(const std::string &model_path);
+
+// generated scenes for bench, the same arguments always give the same scene
+std::shared_ptr<Scene> createMeshScene(int segments);  // a torus of 2 * segments^2 triangles on a floor
+std::shared_ptr<Scene> createSpheresScene(int count);  // count spheres on a grid, some of them mirrors
+std::shared_ptr<Scene> createMirrorScene();             // glass spheres between two facing mirrors
+std::shared_ptr<Scene> createLightsScene(int count);    // count point lights with an attenuation radius
+std::shared_ptr<Scene> createInstancesScene(int count); // count transformed instances of one torus
+
+
+// any of the above by name: demo, mesh, spheres, mirrors, lights, instances. nullptr for unknown names
+std::shared_ptr<Scene> createScene(const std::string &name, const std::string &model_path);
+
+// the models of a scene that can be rebuilt (not borrowed from a mesh file), once however many objects or
+// instances share them
+std::vector<Model *> sceneModels(const Scene &scene);
+
+#endif // _SCENES_H
@@ -0,0 +1,91 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <cstdint>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <ostream>
+
+/**
+ *  render statistics, only compiled in with -DRT_STATS=ON (cmake option), otherwise every macro below is empty
+ *  each thread counts into its own cache line sized slot, totals are summed when asked for,
+ *  so read them between frames, not while rendering
+ */
+class Stats {
+public:
+    enum Counter {
+        primary_rays,
+        shadow_rays,
+        occluder_hits,  // shadow rays blocked by the cached occluder of their light, without traversing the bvh
+        reflection_rays,
+        refraction_rays,
+        sphere_tests,   // one per ray and primitive, packets count their active lanes
+        plane_tests,
+        triangle_tests,
+        bvh_nodes,      // nodes popped by any traversal, top level and model bvhs
+        secondary_nodes, // the part of bvh_nodes spent on the wavefront's reflected and refracted rays
+        intersect_ns,   // wavefront phases, summed over threads
+        shade_ns,
+        spawn_ns,
+        sort_ns,
+        counter_count
+    };
+
+    static constexpr const char *counter_names[counter_count] = {
+        "primary_rays", "shadow_rays", "occluder_hits", "reflection_rays", "refraction_rays",
+        "sphere_tests", "plane_tests", "triangle_tests", "bvh_nodes", "secondary_nodes",
+        "intersect_ns", "shade_ns", "spawn_ns", "sort_ns"
+    };
+
+    static constexpr int max_threads = 256; // later threads share the last slot
+
+    // one tile of a frame, times in microseconds since the last reset
+    struct TileTime {
+        int x0, y0, x1, y1;
+        double start, end;
+    };
+
+    struct alignas(64) Slot {
+        uint64_t counter[counter_count];
+        std::vector<TileTime> tiles;
+    };
+
+    static Slot &local(); // slot of the calling thread
+    static void reset(); // clear counters and tile times, also restarts the trace clock
+    static double now(); // microseconds since the last reset
+
+    static uint64_t total(Counter c);
+    static uint64_t rays(); // primary + shadow + reflection + refraction
+    static double occluderHitRate(); // occluder_hits / shadow_rays
+
+    static void print(std::ostream &out, int slowest_tiles = 5); // counters and the slowest tiles
+    static bool writeTrace(const std::string &path);            // chrome://tracing / perfetto json, one event per tile
+
+private:
+    static Slot slots[max_threads];
+    static std::chrono::steady_clock::time_point epoch;
+};
+
+// adds the time between construction and destruction to a counter
+class StatsTimer {
+public:
+    StatsTimer(Stats::Counter c) : counter(c), start(std::chrono::steady_clock::now()) {}
+    ~StatsTimer() {
+        Stats::local().counter[counter] += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    Stats::Counter counter;
+    std::chrono::steady_clock::time_point start;
+};
+
+#ifdef RT_STATS
+#define RT_COUNT(name, n) (Stats::local().counter[Stats::name] += (n))
+#define RT_TIMER(name) StatsTimer rt_timer_##name(Stats::name)
+#else
+#define RT_COUNT(name, n) ((void)0)
+#define RT_TIMER(name) ((void)0)
+#endif
+
+#endif // _STATS_H
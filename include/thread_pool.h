@@ -0,0 +1,46 @@
+#ifndef _THREAD_POOL_H
+#define _THREAD_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+
+// persistent worker threads, jobs are split into tasks handed out by an atomic counter
+class ThreadPool {
+public:
+    ThreadPool(int threads = 0); // total threads including the caller, 0 means hardware concurrency
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+    ~ThreadPool();
+
+    int size() const; // number of threads working on a job, including the caller
+
+    // run func(task) for every task in [0, count) and wait for all of them, the caller works too
+    // func must not call parallelFor on the same pool
+    void parallelFor(int count, const std::function<void(int)> &func);
+
+private:
+    std::vector<std::thread> workers;
+
+    std::mutex submit_mutex; // one job at a time
+    std::mutex mutex;
+    std::condition_variable work_cv;
+    std::condition_variable done_cv;
+
+    const std::function<void(int)> *job = nullptr;
+    int job_count = 0;
+    std::atomic<int> next_task;
+    int busy = 0;             // workers still on the current job
+    uint64_t generation = 0;  // bumped for every job, wakes the workers
+    bool stop = false;
+
+    void workerLoop();
+    void runTasks();
+};
+
+#endif // _THREAD_POOL_H
@@ -0,0 +1,28 @@
+#ifndef _TRANSFORM_H
+#define _TRANSFORM_H
+
+#include "basic.h"
+
+// affine transform as a 4x4 row-major matrix, the last row is always (0, 0, 0, 1)
+class Transform {
+public:
+    float m[4][4];
+
+    Transform(); // identity
+    Transform(const Transform &) = default;
+    Transform &operator=(const Transform &) = default;
+
+    static Transform translate(const Vector3D &v);
+    static Transform scale(float x, float y, float z);
+    static Transform rotate(const Vector3D &axis, float deg); // counterclockwise around axis
+
+    Transform operator*(const Transform &t) const; // apply t first, then this
+
+    Transform inverse() const;
+
+    Point apply(const Point &p) const;
+    Vector3D apply(const Vector3D &v) const;        // linear part only, directions
+    Vector3D applyNormal(const Vector3D &n) const;  // transposed linear part, call it on the inverse to move normals
+};
+
+#endif // _TRANSFORM_H
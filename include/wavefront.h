@@ -0,0 +1,75 @@
+#ifndef _WAVEFRONT_H
+#define _WAVEFRONT_H
+
+#include <cstdint>
+#include <vector>
+#include "basic.h"
+#include "packet.h"
+
+class Scene;
+
+// rays waiting for the same phase, in SoA layout
+class RayQueue {
+public:
+    std::vector<float> ox, oy, oz; // origins
+    std::vector<float> dx, dy, dz; // normalized directions
+    std::vector<float> wr, wg, wb; // throughput, the share of this ray's color that reaches the pixel
+    std::vector<int> pixel;        // index in the output color array
+    std::vector<int> depth;
+
+    int size() const { return (int)pixel.size(); }
+    void clear();
+    void reserve(int n);
+    void resize(int n); // for filling it by index
+    void push(const Ray &ray, const Vector3D &weight, int pixel, int depth);
+
+    Ray ray(int i) const; // the direction is stored normalized already, it isn't normalized again
+    Vector3D weight(int i) const { return Vector3D(wr[i], wg[i], wb[i]); }
+};
+
+/**
+ *  iterative version of Scene::rayTrace, one bounce of every ray at a time:
+ *  generate camera rays -> intersect -> shade (shadow rays per light) -> spawn secondary rays -> intersect ...
+ *  reflection and refraction become new queue entries weighted by F and 1 - F instead of recursive calls,
+ *  every phase walks the whole queue, intersection and shadow tests go through packets.
+ *  secondary rays leave their hits in all directions, so with Scene::sort_rays they are sorted by direction
+ *  octant and then by the morton code of their origin before the next bounce, and a packet holds rays that
+ *  start close together and go the same way. off by default: the queues of a 16x16 tile are coherent already,
+ *  see secondary_nodes in stats.h for the effect on a scene
+ */
+class Wavefront {
+public:
+    // trace camera rays through the sub-pixel positions (x[i], y[i]), same results as Scene::rayTrace.
+    // primary, when given, gets the first hit of every camera ray
+    void trace(Scene &scene, const float *x, const float *y, int count, int windowWidth, int windowHeight, Vector3D *color,
+               Hit *primary = nullptr);
+
+private:
+    RayQueue queue;       // rays of the current bounce
+    RayQueue reflected;   // secondary rays of the next bounce, reflection and refraction
+    RayQueue refracted;   // are kept apart so packets of the next bounce stay coherent
+
+    std::vector<uint64_t> key; // sort(): octant and origin cell in the high bits, queue index in the low ones
+    RayQueue sorted;
+
+    // closest hit of every queue entry, object < 0 for misses
+    std::vector<float> hx, hy, hz;
+    std::vector<float> nx, ny, nz;
+    std::vector<float> dist;
+    std::vector<int> object;
+
+    // shadow rays of the bounce, entry is the queue index they belong to, light the index in Scene::light_list
+    RayQueue shadow;
+    std::vector<float> shadow_t;
+    std::vector<int> shadow_entry;
+    std::vector<int> shadow_light;
+
+    void intersect(Scene &scene);
+    void shade(Scene &scene, Vector3D *color);
+    void spawn(Scene &scene);
+    void sort(Scene &scene);
+
+    Hit hit(int i) const;
+};
+
+#endif // _WAVEFRONT_H
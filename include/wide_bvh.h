@@ -0,0 +1,160 @@
+#ifndef _WIDE_BVH_H
+#define _WIDE_BVH_H
+
+#include <bit>
+#include <cstdint>
+#include "basic.h"
+#include "bvh.h"
+#include "stats.h"
+
+// compact 4-wide bvh over triangles, converted from a binary BVH. a node is one cache line with the boxes of up
+// to 4 children quantized to 8 bits on a grid over the node's box, leaves are blocks of triangles whose corners
+// index the block's own deduplicated vertices. tested 4 boxes at a time with float4
+class WideBVH {
+public:
+    static constexpr int width = 4;
+    static constexpr int leaf_size = 8;   // binary subtrees with at most this many triangles become one leaf block
+    static constexpr int max_block = 64;  // triangles of a leaf block, larger binary leaves are split
+    static constexpr int stack_size = 256; // (width - 1) per level of a tree no deeper than BVH::stack_size, and more
+
+    // 64 bytes
+    struct alignas(64) Node {
+        float origin[3];       // grid origin, the min corner of the node box
+        int8_t exponent[3];    // the grid step of an axis is 2^exponent
+        uint8_t children;      // used slots, always the first ones
+        uint8_t lo[3][width];  // child box min in grid steps, rounded down
+        uint8_t hi[3][width];  // child box max in grid steps, rounded up
+        int child[width];      // node index of an interior child, block index of a leaf child
+        uint8_t count[width];  // triangles of a leaf child, 0 for an interior one
+    };
+
+    // a leaf, triangle k has the corners vertices[vertex + corner[3 * (triangle + k) + c]]
+    struct Block {
+        int vertex;
+        int triangle;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<Block> blocks;
+    std::vector<uint8_t> corner; // three per triangle
+    std::vector<Point> vertices;
+    AABB box; // bounds of everything
+
+    // from a binary bvh whose primitive i is the triangle (vertex[index[3i]], vertex[index[3i + 1]], vertex[index[3i + 2]])
+    void build(const BVH &bvh, const std::vector<Point> &vertex, const std::vector<int> &index);
+
+    bool empty() const { return nodes.empty(); }
+    size_t bytes() const; // memory of the arrays above
+
+    // closest hit traversal, func(v0, v1, v2) tests a triangle and shrinks t_max when it finds a closer hit
+    template <typename Func>
+    void traverse(const Ray &ray, float &t_max, Func &&func) const;
+
+    // any hit traversal, stop as soon as func(v0, v1, v2) returns true
+    template <typename Func>
+    bool occluded(const Ray &ray, float t_max, Func &&func) const;
+
+private:
+    // slab test of the children of a node, return the mask of the hit ones and their entry distances
+    static int intersect(const Node &node, const Ray &ray, const Vector3D &inv_dir, float t_max, float *t_enter);
+
+    // func(v0, v1, v2) on the triangles of a block until it returns true
+    template <typename Func>
+    bool forEachTriangle(int block, int count, Func &&func) const;
+};
+
+inline int WideBVH::intersect(const Node &node, const Ray &ray, const Vector3D &inv_dir, float t_max, float *t_enter) {
+    float4 t_min4(0.0f), t_max4(t_max);
+    for (int axis = 0; axis < 3; axis++) {
+        float4 origin((&ray.start.x)[axis]), inv((&inv_dir.x)[axis]);
+        float4 grid(node.origin[axis]), step(std::bit_cast<float>((uint32_t)(node.exponent[axis] + 127) << 23));
+        float4 t1 = (grid + float4::fromBytes(node.lo[axis]) * step - origin) * inv;
+        float4 t2 = (grid + float4::fromBytes(node.hi[axis]) * step - origin) * inv;
+        t_min4 = vmax(t_min4, vmin(t1, t2));
+        t_max4 = vmin(t_max4, vmax(t1, t2));
+    }
+    t_min4.store(t_enter);
+    return lessEqual(t_min4, t_max4) & ((1 << node.children) - 1);
+}
+
+template <typename Func>
+bool WideBVH::forEachTriangle(int block, int count, Func &&func) const {
+    const Block &b = blocks[block];
+    const Point *v = vertices.data() + b.vertex;
+    const uint8_t *c = corner.data() + 3 * b.triangle;
+    for (int k = 0; k < count; k++, c += 3) {
+        if (func(v[c[0]], v[c[1]], v[c[2]])) return true;
+    }
+    return false;
+}
+
+template <typename Func>
+void WideBVH::traverse(const Ray &ray, float &t_max, Func &&func) const {
+    if (nodes.empty()) return;
+
+    Vector3D inv_dir = ray.invDir();
+    struct Entry {
+        int child, count; // a node when count is 0, otherwise a block
+        float t;          // entry distance
+    } stack[stack_size];
+    int top = 0;
+
+    float t_root = box.intersection(ray, inv_dir, t_max);
+    if (t_root < 0) return;
+    stack[top++] = {0, 0, t_root};
+
+    while (top > 0) {
+        Entry e = stack[--top];
+
+        // a closer hit may have been found since it was pushed
+        if (e.t > t_max) continue;
+
+        if (e.count > 0) {
+            forEachTriangle(e.child, e.count, [&](const Point &v0, const Point &v1, const Point &v2) {
+                func(v0, v1, v2);
+                return false;
+            });
+            continue;
+        }
+
+        const Node &node = nodes[e.child];
+        RT_COUNT(bvh_nodes, 1);
+        float t_enter[width];
+        int mask = intersect(node, ray, inv_dir, t_max, t_enter);
+
+        // push the hit children farthest first, so the nearest is visited next
+        int order[width], hits = 0;
+        for (; mask; mask &= mask - 1) {
+            int slot = std::countr_zero((unsigned)mask), i = hits++;
+            for (; i > 0 && t_enter[order[i - 1]] < t_enter[slot]; i--) order[i] = order[i - 1];
+            order[i] = slot;
+        }
+        for (int i = 0; i < hits; i++) stack[top++] = {node.child[order[i]], node.count[order[i]], t_enter[order[i]]};
+    }
+}
+
+template <typename Func>
+bool WideBVH::occluded(const Ray &ray, float t_max, Func &&func) const {
+    if (nodes.empty() || box.intersection(ray, ray.invDir(), t_max) < 0) return false;
+
+    Vector3D inv_dir = ray.invDir();
+    int stack[stack_size];
+    int top = 0;
+    stack[top++] = 0;
+
+    // order doesn't matter here, leaves are tested as soon as their box is hit and any blocker ends the query
+    while (top > 0) {
+        const Node &node = nodes[stack[--top]];
+        RT_COUNT(bvh_nodes, 1);
+        float t_enter[width];
+        for (int mask = intersect(node, ray, inv_dir, t_max, t_enter); mask; mask &= mask - 1) {
+            int slot = std::countr_zero((unsigned)mask);
+            if (node.count[slot] == 0) stack[top++] = node.child[slot];
+            else if (forEachTriangle(node.child[slot], node.count[slot], func)) return true;
+        }
+    }
+
+    return false;
+}
+
+#endif // _WIDE_BVH_H
@@ -0,0 +1,252 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include "basic.h"
+#include "objects.h"
+#include "scenes.h"
+#include "stats.h"
+
+// render a fixed set of scenes at several resolutions and thread counts, write the timings as json
+struct Options {
+    std::vector<std::string> scenes = {"demo", "mesh", "spheres", "mirrors", "lights", "instances"};
+    std::vector<std::pair<int, int>> resolutions = {{640, 360}, {1280, 720}};
+    std::vector<int> threads; // empty: 1, 2, 4 ... up to all cores
+    int frames = 3;
+    std::string output = "-";
+    std::string model = "../model/model.obj";
+};
+
+struct Result {
+    std::string scene;
+    int width, height, threads;
+    double ms_per_frame; // median of the timed frames
+    double ms_min;
+    double mrays_per_s;  // camera rays only
+    double rays_per_frame; // every traced ray, RT_STATS builds only (0 otherwise)
+    double all_mrays_per_s;
+    double occluder_hit_rate; // shadow rays blocked by the occluder cache, RT_STATS builds only
+    double scaling_efficiency;
+};
+
+// bvh build of one model of a scene
+struct BuildResult {
+    std::string scene;
+    int triangles;
+    std::string builder;
+    int threads;
+    double ms; // fastest of the timed builds
+    float sah_cost;
+    double bytes_per_triangle;         // bvh and triangles
+    double compact_ms;                 // conversion to the compact wide bvh, on top of the build
+    double compact_bytes_per_triangle;
+};
+
+static void usage(const char *name) {
+    std::cout << "usage: " << name << " [options]\n"
+              << "  -s, --scenes <list>       comma separated, from demo,mesh,spheres,mirrors,lights,instances (default all)\n"
+              << "  -r, --resolutions <list>  comma separated WxH (default 640x360,1280x720)\n"
+              << "  -t, --threads <list>      comma separated thread counts (default 1,2,4... up to all cores)\n"
+              << "  -f, --frames <n>          timed frames per run, after one warm-up frame (default 3)\n"
+              << "  -o, --output <path>       json output, - for stdout (default -)\n"
+              << "  -m, --model <path>        obj model of the demo scene (default ../model/model.obj)\n";
+}
+
+static std::vector<std::string> split(const std::string &s) {
+    std::vector<std::string> ret;
+    std::stringstream in(s);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        if (!item.empty()) ret.push_back(item);
+    }
+    return ret;
+}
+
+static bool parseArgs(int argc, char *argv[], Options &opt) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help") return false;
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+
+        const char *value = argv[++i];
+        if (arg == "-s" || arg == "--scenes") opt.scenes = split(value);
+        else if (arg == "-r" || arg == "--resolutions") {
+            opt.resolutions.clear();
+            for (auto &r : split(value)) {
+                int w = 0, h = 0;
+                if (std::sscanf(r.c_str(), "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) {
+                    std::cerr << "Bad resolution: " << r << std::endl;
+                    return false;
+                }
+                opt.resolutions.emplace_back(w, h);
+            }
+        }
+        else if (arg == "-t" || arg == "--threads") {
+            opt.threads.clear();
+            for (auto &t : split(value)) opt.threads.push_back(std::atoi(t.c_str()));
+        }
+        else if (arg == "-f" || arg == "--frames") opt.frames = std::atoi(value);
+        else if (arg == "-o" || arg == "--output") opt.output = value;
+        else if (arg == "-m" || arg == "--model") opt.model = value;
+        else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return false;
+        }
+    }
+
+    if (opt.threads.empty()) {
+        int cores = std::max(1u, std::thread::hardware_concurrency());
+        for (int t = 1; t < cores; t *= 2) opt.threads.push_back(t);
+        opt.threads.push_back(cores);
+    }
+
+    return opt.frames > 0 && !opt.scenes.empty() && !opt.resolutions.empty() &&
+           std::all_of(opt.threads.begin(), opt.threads.end(), [](int t) { return t > 0; });
+}
+
+static void writeJson(std::ostream &out, const Options &opt, const std::vector<Result> &results, const std::vector<BuildResult> &builds) {
+    out << "{\n"
+        << "  \"version\": 1,\n"
+        << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n"
+        << "  \"frames\": " << opt.frames << ",\n"
+        << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        auto &r = results[i];
+        out << "    {\"scene\": \"" << r.scene << "\", \"width\": " << r.width << ", \"height\": " << r.height
+            << ", \"threads\": " << r.threads << ", \"ms_per_frame\": " << r.ms_per_frame << ", \"ms_min\": " << r.ms_min
+            << ", \"mrays_per_s\": " << r.mrays_per_s << ", \"scaling_efficiency\": " << r.scaling_efficiency;
+#ifdef RT_STATS
+        out << ", \"rays_per_frame\": " << r.rays_per_frame << ", \"all_mrays_per_s\": " << r.all_mrays_per_s
+            << ", \"occluder_hit_rate\": " << r.occluder_hit_rate;
+#endif
+        out << "}" << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ],\n"
+        << "  \"builds\": [\n";
+    for (size_t i = 0; i < builds.size(); i++) {
+        auto &b = builds[i];
+        out << "    {\"scene\": \"" << b.scene << "\", \"triangles\": " << b.triangles << ", \"builder\": \"" << b.builder
+            << "\", \"threads\": " << b.threads << ", \"ms\": " << b.ms << ", \"sah_cost\": " << b.sah_cost
+            << ", \"bytes_per_triangle\": " << b.bytes_per_triangle << ", \"compact_ms\": " << b.compact_ms
+            << ", \"compact_bytes_per_triangle\": " << b.compact_bytes_per_triangle << "}"
+            << (i + 1 < builds.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n"
+        << "}\n";
+}
+
+int main(int argc, char *argv[]) {
+    Options opt;
+    if (!parseArgs(argc, argv, opt)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<Result> results;
+    std::vector<BuildResult> builds;
+    for (auto &name : opt.scenes) {
+        auto s = createScene(name, opt.model);
+        if (!s) {
+            std::cerr << "Unknown scene: " << name << std::endl;
+            return 1;
+        }
+
+        for (auto [width, height] : opt.resolutions) {
+            std::vector<unsigned char> pixel(width * height * 3);
+            double base = 0; // ms * threads of the first thread count, for the scaling efficiency
+
+            for (int threads : opt.threads) {
+                s->threads = threads;
+                s->render(pixel.data(), width, height); // warm-up: bvh, thread pool, per-thread queues
+
+                std::vector<double> ms;
+                int64_t camera_rays = 0;
+#ifdef RT_STATS
+                Stats::reset();
+#endif
+                for (int f = 0; f < opt.frames; f++) {
+                    auto start = std::chrono::steady_clock::now();
+                    s->render(pixel.data(), width, height);
+                    auto end = std::chrono::steady_clock::now();
+                    ms.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+                    camera_rays += s->last_samples;
+                }
+                std::sort(ms.begin(), ms.end());
+
+                Result r{name, width, height, threads};
+#ifdef RT_STATS
+                r.rays_per_frame = (double)Stats::rays() / opt.frames;
+                r.occluder_hit_rate = Stats::occluderHitRate();
+#endif
+                r.ms_per_frame = ms[ms.size() / 2];
+                r.ms_min = ms.front();
+                r.mrays_per_s = (double)camera_rays / opt.frames / (r.ms_per_frame * 1000);
+                r.all_mrays_per_s = r.rays_per_frame / (r.ms_per_frame * 1000);
+                if (base == 0) base = r.ms_per_frame * threads;
+                r.scaling_efficiency = base / (r.ms_per_frame * threads);
+                results.push_back(r);
+
+                std::cerr << name << " " << width << "x" << height << " threads " << threads << ": "
+                          << r.ms_per_frame << " ms/frame, " << r.mrays_per_s << " Mrays/s" << std::endl;
+            }
+        }
+
+        // build every model again with each builder, on a copy so the scene keeps its own tree
+        for (Model *model : sceneModels(*s)) {
+            for (auto [builder, builder_name] : {std::pair{BVH::binned_sah, "sah"}, std::pair{BVH::lbvh, "lbvh"}}) {
+                for (int threads : opt.threads) {
+                    Model copy;
+                    copy.builder = builder;
+                    copy.build_threads = threads;
+                    double best = 0;
+                    for (int f = 0; f < opt.frames; f++) {
+                        copy.vertex = model->vertex;
+                        copy.index = model->index;
+                        auto start = std::chrono::steady_clock::now();
+                        copy.build();
+                        auto end = std::chrono::steady_clock::now();
+                        double ms = std::chrono::duration<double, std::milli>(end - start).count();
+                        if (f == 0 || ms < best) best = ms;
+                    }
+
+                    int triangles = copy.triangle.size();
+                    BuildResult b{name, triangles, builder_name, threads, best, copy.bvh.sahCost(), (double)copy.geometryBytes() / triangles};
+
+                    auto start = std::chrono::steady_clock::now();
+                    WideBVH wide;
+                    wide.build(copy.bvh, copy.vertex, copy.index);
+                    auto end = std::chrono::steady_clock::now();
+                    b.compact_ms = std::chrono::duration<double, std::milli>(end - start).count();
+                    b.compact_bytes_per_triangle = (double)wide.bytes() / triangles;
+
+                    builds.push_back(b);
+                    std::cerr << name << " build " << b.triangles << " triangles " << builder_name << " threads " << threads << ": "
+                              << b.ms << " ms, sah cost " << b.sah_cost << ", " << b.bytes_per_triangle << " bytes per triangle, compact "
+                              << b.compact_ms << " ms more, " << b.compact_bytes_per_triangle << " bytes per triangle" << std::endl;
+                }
+            }
+        }
+    }
+
+    if (opt.output == "-") {
+        writeJson(std::cout, opt, results, builds);
+    }
+    else {
+        std::ofstream out(opt.output);
+        if (!out) {
+            std::cerr << "Can't write " << opt.output << std::endl;
+            return 1;
+        }
+        writeJson(out, opt, results, builds);
+    }
+
+    return 0;
+}
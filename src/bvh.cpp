@@ -0,0 +1,369 @@
+#include <bit>
+#include "bvh.h"
+#include "thread_pool.h"
+
+namespace {
+
+// nodes with more primitives than this bin their primitives in parallel chunks
+constexpr int parallel_bin_size = 1 << 16;
+// inputs smaller than this are built on the calling thread, starting threads would cost more
+constexpr int parallel_build_size = 1 << 14;
+
+// func(begin, end) over [0, n) in chunks, spread over the pool when there is one
+void parallelRange(ThreadPool *pool, int n, const std::function<void(int, int)> &func) {
+    if (!pool || n < parallel_bin_size) {
+        func(0, n);
+        return;
+    }
+    int chunks = pool->size() * 4;
+    int step = (n + chunks - 1) / chunks;
+    pool->parallelFor(chunks, [&](int c) {
+        int begin = c * step, end = std::min(n, begin + step);
+        if (begin < end) func(begin, end);
+    });
+}
+
+// what the SAH builder keeps while splitting
+struct SAHBuild {
+    const std::vector<AABB> &boxes;
+    std::vector<Vector3D> centroids;
+    std::vector<int> &index;
+    ThreadPool *pool = nullptr; // only set for the top levels, subtrees are built one per thread
+    int task_size = 0;          // top levels leave nodes this small to tasks
+    std::vector<std::pair<int, int>> tasks; // node and depth
+
+    void subdivide(std::vector<BVH::Node> &nodes, int node, int depth);
+};
+
+// primitive counts and bounds of the bins of one axis
+struct Bins {
+    AABB box[BVH::bins];
+    int count[BVH::bins] = {};
+
+    void merge(const Bins &b) {
+        for (int i = 0; i < BVH::bins; i++) {
+            box[i].expand(b.box[i]);
+            count[i] += b.count[i];
+        }
+    }
+};
+
+}
+
+/**
+ *  SAH: cost(split) = traversal_cost + (A(left) * N(left) + A(right) * N(right)) / A(node)
+ *       cost(leaf)  = N(node)
+ *
+ *  candidates are the borders of equal width bins over the centroid bounds
+ */
+void SAHBuild::subdivide(std::vector<BVH::Node> &nodes, int node, int depth) {
+    constexpr int bins = BVH::bins;
+    BVH::Node &n = nodes[node];
+    if (n.count <= task_size) {
+        tasks.emplace_back(node, depth);
+        return;
+    }
+
+    // bounds, in parallel chunks on the top levels only, a lock per node costs too much further down
+    bool parallel = pool && n.count >= parallel_bin_size;
+    std::mutex merge_mutex;
+    AABB centroid_box;
+    // the lambdas copy what they read to locals, the stores to boxes could alias it otherwise
+    const int *prim = index.data() + n.first;
+    const AABB *box_of = boxes.data();
+    const Vector3D *centroid_of = centroids.data();
+    auto bound = [prim, box_of, centroid_of](int begin, int end, AABB &box, AABB &centroid) {
+        for (int i = begin; i < end; i++) {
+            box.expand(box_of[prim[i]]);
+            centroid.expand(AABB(centroid_of[prim[i]], centroid_of[prim[i]]));
+        }
+    };
+    if (!parallel) {
+        AABB box;
+        bound(0, n.count, box, centroid_box);
+        n.box = box;
+    }
+    else {
+        parallelRange(pool, n.count, [&](int begin, int end) {
+            AABB box, centroid;
+            bound(begin, end, box, centroid);
+            std::lock_guard<std::mutex> lock(merge_mutex);
+            n.box.expand(box);
+            centroid_box.expand(centroid);
+        });
+    }
+
+    if (n.count == 1 || depth >= BVH::stack_size) return;
+
+    // bin every axis the centroids spread along and find the best split over all of them
+    int best_axis = -1, best_bin = -1;
+    float best_cost = FLOAT_MAX;
+    for (int axis = 0; axis < 3; axis++) {
+        float lo = (&centroid_box.min.x)[axis];
+        float hi = (&centroid_box.max.x)[axis];
+        if (fequal(lo, hi)) continue;
+
+        float scale = bins / (hi - lo);
+        auto bin_range = [prim, box_of, centroid_of, axis, lo, scale](int begin, int end, Bins &bin) {
+            for (int i = begin; i < end; i++) {
+                int b = std::min(bins - 1, (int)(((&centroid_of[prim[i]].x)[axis] - lo) * scale));
+                bin.box[b].expand(box_of[prim[i]]);
+                bin.count[b]++;
+            }
+        };
+        Bins bin;
+        if (!parallel) bin_range(0, n.count, bin);
+        else {
+            parallelRange(pool, n.count, [&](int begin, int end) {
+                Bins local;
+                bin_range(begin, end, local);
+                std::lock_guard<std::mutex> lock(merge_mutex);
+                bin.merge(local);
+            });
+        }
+
+        // sweep from the right to get the right side of every border, then from the left
+        float right_area[bins - 1];
+        int right_count[bins - 1];
+        AABB acc;
+        int count = 0;
+        for (int b = bins - 1; b > 0; b--) {
+            acc.expand(bin.box[b]);
+            count += bin.count[b];
+            right_area[b - 1] = acc.surfaceArea();
+            right_count[b - 1] = count;
+        }
+
+        acc = AABB();
+        count = 0;
+        for (int b = 0; b < bins - 1; b++) {
+            acc.expand(bin.box[b]);
+            count += bin.count[b];
+            if (count == 0 || right_count[b] == 0) continue;
+            float cost = acc.surfaceArea() * count + right_area[b] * right_count[b];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin = b;
+            }
+        }
+    }
+
+    // all centroids coincide, nothing to split
+    if (best_axis == -1) return;
+
+    float area = n.box.surfaceArea();
+    best_cost = area > 0 ? BVH::traversal_cost + best_cost / area : FLOAT_MAX;
+    if (best_cost >= n.count && n.count <= BVH::max_leaf) return;
+
+    // partition the primitives by the chosen border
+    float lo = (&centroid_box.min.x)[best_axis];
+    float scale = bins / ((&centroid_box.max.x)[best_axis] - lo);
+    auto mid = std::partition(index.begin() + n.first, index.begin() + n.first + n.count, [&](int i) {
+        return std::min(bins - 1, (int)(((&centroids[i].x)[best_axis] - lo) * scale)) <= best_bin;
+    });
+    int left_count = mid - index.begin() - n.first;
+
+    int left = nodes.size();
+    nodes.push_back({AABB(), n.first, left_count});
+    nodes.push_back({AABB(), n.first + left_count, n.count - left_count});
+    n.first = left;
+    n.count = 0;
+
+    subdivide(nodes, left, depth + 1);
+    subdivide(nodes, left + 1, depth + 1);
+}
+
+static void buildSAH(std::vector<BVH::Node> &nodes, std::vector<int> &index, const std::vector<AABB> &boxes, ThreadPool *pool) {
+    SAHBuild build{boxes, std::vector<Vector3D>(boxes.size()), index};
+    parallelRange(pool, boxes.size(), [&](int begin, int end) {
+        for (int i = begin; i < end; i++) build.centroids[i] = boxes[i].centroid();
+    });
+
+    // a binary tree with n leaves at most has 2n - 1 nodes, reserve them so references stay valid
+    nodes.reserve(boxes.size() * 2 - 1);
+    nodes.push_back({AABB(), 0, (int)boxes.size()});
+    if (!pool) {
+        build.subdivide(nodes, 0, 1);
+        return;
+    }
+
+    // split the top levels here, with parallel binning, until there are a few subtrees per thread
+    build.pool = pool;
+    build.task_size = std::max<int>(BVH::max_leaf, boxes.size() / (pool->size() * 8));
+    build.subdivide(nodes, 0, 1);
+
+    // then build the subtrees as tasks, each into its own array. their primitive ranges don't overlap
+    std::vector<std::pair<int, int>> tasks = std::move(build.tasks);
+    std::vector<std::vector<BVH::Node>> subtrees(tasks.size());
+    build.pool = nullptr;
+    build.task_size = 0;
+    pool->parallelFor(tasks.size(), [&](int t) {
+        auto &sub = subtrees[t];
+        const BVH::Node &root = nodes[tasks[t].first];
+        sub.reserve(root.count * 2 - 1);
+        sub.push_back({AABB(), root.first, root.count});
+        build.subdivide(sub, 0, tasks[t].second); // the subtree's primitives only, nothing else is written
+    });
+
+    // a subtree root replaces its task node, the rest is appended after the top levels so children stay behind parents
+    for (int t = 0; t < (int)tasks.size(); t++) {
+        auto &sub = subtrees[t];
+        int offset = nodes.size() - 1;
+        for (auto &node : sub) {
+            if (node.count == 0) node.first += offset;
+        }
+        nodes[tasks[t].first] = sub[0];
+        nodes.insert(nodes.end(), sub.begin() + 1, sub.end());
+    }
+}
+
+// spread the low 10 bits of v to every third bit
+static uint32_t expandBits(uint32_t v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+uint32_t BVH::morton(const Point &p, const AABB &box) {
+    Vector3D extent = box.max - box.min;
+    auto cell = [](float v, float lo, float size) { return size > 0 ? (uint32_t)std::clamp((v - lo) / size * 1024, 0.0f, 1023.0f) : 0u; };
+    return expandBits(cell(p.x, box.min.x, extent.x)) << 2 | expandBits(cell(p.y, box.min.y, extent.y)) << 1 | expandBits(cell(p.z, box.min.z, extent.z));
+}
+
+/**
+ *  LBVH (Karras 2012, "Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees"):
+ *  primitives sorted by the 30 bit morton code of their centroid, internal node i of the n - 1 covers a
+ *  range with i at one end and splits it where the highest differing bit of the codes changes.
+ *  every internal node is found on its own, then the tree is laid out like the SAH one and refit
+ */
+static void buildLBVH(std::vector<BVH::Node> &nodes, std::vector<int> &index, const std::vector<AABB> &boxes, ThreadPool *pool) {
+    int n = boxes.size();
+    AABB centroid_box;
+    for (auto &b : boxes) centroid_box.expand(Point::zero + b.centroid());
+
+    std::vector<uint32_t> code(n), sorted_code(n);
+    std::vector<int> sorted_index(n);
+    parallelRange(pool, n, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) code[i] = BVH::morton(Point::zero + boxes[i].centroid(), centroid_box);
+    });
+
+    // lsd radix sort of (code, primitive), 4 passes of 8 bits, stable so equal codes keep primitive order
+    for (int i = 0; i < n; i++) index[i] = i;
+    for (int shift = 0; shift < 32; shift += 8) {
+        int offset[257] = {};
+        for (int i = 0; i < n; i++) offset[(code[index[i]] >> shift & 0xFF) + 1]++;
+        for (int b = 0; b < 256; b++) offset[b + 1] += offset[b];
+        for (int i = 0; i < n; i++) sorted_index[offset[code[index[i]] >> shift & 0xFF]++] = index[i];
+        index.swap(sorted_index);
+    }
+    for (int i = 0; i < n; i++) sorted_code[i] = code[index[i]];
+
+    // length of the common prefix of the codes at i and j, equal codes fall back on the positions
+    auto delta = [&](int i, int j) {
+        if (j < 0 || j >= n) return -1;
+        uint32_t x = sorted_code[i] ^ sorted_code[j];
+        return x ? std::countl_zero(x) : 32 + std::countl_zero((uint32_t)(i ^ j));
+    };
+
+    // internal node i covers [lo[i], hi[i]] and its children split it after split[i]
+    std::vector<int> lo(std::max(n - 1, 1)), hi(std::max(n - 1, 1)), split(std::max(n - 1, 1));
+    parallelRange(pool, n - 1, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            // direction of the range, and its other end by exponential then binary search
+            int d = delta(i, i + 1) > delta(i, i - 1) ? 1 : -1;
+            int delta_min = delta(i, i - d);
+            int l_max = 2;
+            while (delta(i, i + l_max * d) > delta_min) l_max *= 2;
+            int l = 0;
+            for (int t = l_max / 2; t >= 1; t /= 2) {
+                if (delta(i, i + (l + t) * d) > delta_min) l += t;
+            }
+            int j = i + l * d;
+
+            // the split is where the common prefix with i gets shorter than the node's
+            int delta_node = delta(i, j);
+            int s = 0;
+            for (int t = (l + 1) / 2;; t = (t + 1) / 2) {
+                if (delta(i, i + (s + t) * d) > delta_node) s += t;
+                if (t == 1) break;
+            }
+            lo[i] = std::min(i, j);
+            hi[i] = std::max(i, j);
+            split[i] = i + s * d + std::min(d, 0);
+        }
+    });
+
+    // lay it out with children in pairs behind their parent, and cut ranges of up to max_leaf into leaves
+    nodes.reserve(n * 2 - 1);
+    nodes.push_back({AABB(), 0, n});
+    struct Pending {
+        int node, internal, depth; // in nodes, in lo / hi / split
+    };
+    std::vector<Pending> pending = {{0, 0, 1}};
+    while (!pending.empty()) {
+        auto [node, internal, depth] = pending.back();
+        pending.pop_back();
+        if (nodes[node].count <= BVH::max_leaf || depth >= BVH::stack_size) continue;
+
+        int first = nodes.size();
+        int mid = split[internal];
+        nodes.push_back({AABB(), lo[internal], mid - lo[internal] + 1});
+        nodes.push_back({AABB(), mid + 1, hi[internal] - mid});
+        nodes[node].first = first;
+        nodes[node].count = 0;
+
+        // a child covering more than one primitive is internal node mid (left) or mid + 1 (right)
+        if (mid > lo[internal]) pending.push_back({first, mid, depth + 1});
+        if (mid + 1 < hi[internal]) pending.push_back({first + 1, mid + 1, depth + 1});
+    }
+}
+
+void BVH::build(const std::vector<AABB> &boxes, Builder builder, int threads) {
+    std::vector<Node> node_list;
+    std::vector<int> prim_index(boxes.size());
+    for (int i = 0; i < (int)prim_index.size(); i++) prim_index[i] = i;
+
+    if (!boxes.empty()) {
+        if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        std::unique_ptr<ThreadPool> pool;
+        if (threads > 1 && (int)boxes.size() >= parallel_build_size) pool = std::make_unique<ThreadPool>(threads);
+
+        if (builder == lbvh) buildLBVH(node_list, prim_index, boxes, pool.get());
+        else buildSAH(node_list, prim_index, boxes, pool.get());
+    }
+
+    nodes = Buffer<Node>(std::move(node_list));
+    index = Buffer<int>(std::move(prim_index));
+    if (builder == lbvh) refit(boxes);
+}
+
+void BVH::refit(const std::vector<AABB> &boxes) {
+    // children are always stored after their parent, so a reverse sweep sees them first
+    Node *node = nodes.mutableData();
+    for (int i = (int)nodes.size() - 1; i >= 0; i--) {
+        Node &n = node[i];
+        n.box = AABB();
+        if (n.count > 0) {
+            for (int j = n.first; j < n.first + n.count; j++) n.box.expand(boxes[index[j]]);
+        }
+        else {
+            n.box.expand(node[n.first].box);
+            n.box.expand(node[n.first + 1].box);
+        }
+    }
+}
+
+float BVH::sahCost() const {
+    if (nodes.empty()) return 0;
+    float root_area = nodes[0].box.surfaceArea();
+    if (root_area <= 0) return nodes[0].count;
+
+    double cost = 0;
+    for (auto &n : nodes) {
+        cost += (n.count > 0 ? n.count : traversal_cost) * n.box.surfaceArea();
+    }
+    return cost / root_area;
+}
@@ -0,0 +1,165 @@
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <string>
+#include <cstring>
+#include "basic.h"
+#include "objects.h"
+#include "scenes.h"
+#include "image.h"
+#include "progressive.h"
+#include "stats.h"
+
+// render the demo scene without a window and save it to an image file
+struct Options {
+    int width = 1280;
+    int height = 720;
+    int threads = 0;
+    bool packets = true;
+    bool wavefront = true;
+    bool sort_rays = false;
+    bool occluder_cache = true;
+    int depth = 5;
+    bool roulette = true;
+    int light_samples = 4;
+    int aa_min = 1;
+    int aa_max = 16;
+    float aa_threshold = 0.1f;
+    bool compact = false;
+    int spp = 0;       // progressive mode when spp or time is set
+    double time = 0;
+    std::string output = "output.png";
+    std::string trace;  // chrome trace of the tiles, RT_STATS builds only
+    std::string scene = "demo";
+    std::string model = "../model/model.obj";
+};
+
+static void usage(const char *name) {
+    std::cout << "usage: " << name << " [options]\n"
+              << "  -w, --width <n>      image width (default 1280)\n"
+              << "  -h, --height <n>     image height (default 720)\n"
+              << "  -t, --threads <n>    render threads, 0 for all cores (default 0)\n"
+              << "  -p, --packets <0|1>  trace primary and shadow rays in packets (default 1)\n"
+              << "  -W, --wavefront <0|1> trace bounce by bounce over ray queues (default 1)\n"
+              << "  --sort <0|1>         sort secondary rays by direction and origin, wavefront only (default 0)\n"
+              << "  --occluder-cache <0|1> test the last blocker of a light first for its shadow rays (default 1)\n"
+              << "  -d, --depth <n>      max bounces after the camera ray (default 5)\n"
+              << "  -r, --roulette <0|1> russian roulette for rays adding < 1/255, 0 cuts them (default 1)\n"
+              << "  -l, --light-samples <n> shadow rays per hit when more lights reach it (default 4)\n"
+              << "  -a, --aa-max <n>     adaptive anti-aliasing, samples of edge pixels, 1 turns it off (default 16)\n"
+              << "  --aa-min <n>         samples of every pixel, 1 is the pixel center (default 1)\n"
+              << "  --aa-threshold <t>   color difference that marks an edge pixel (default 0.1)\n"
+              << "  -c, --compact <0|1>  trace models through the compressed wide bvh (default 0)\n"
+              << "  -s, --spp <n>        progressive mode, at most n samples per pixel\n"
+              << "  -T, --time <ms>      progressive mode, stop after this time\n"
+              << "  -o, --output <path>  output image, .png or .ppm (default output.png)\n"
+              << "  --trace <path>       write a chrome trace json of the tiles (RT_STATS builds only)\n"
+              << "  -S, --scene <name>   demo, mesh, spheres, mirrors, lights or instances, see scenes.h (default demo)\n"
+              << "  -m, --model <path>   obj model of the demo scene (default ../model/model.obj)\n";
+}
+
+static bool parseArgs(int argc, char *argv[], Options &opt) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help") return false;
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+
+        const char *value = argv[++i];
+        if (arg == "-w" || arg == "--width") opt.width = std::atoi(value);
+        else if (arg == "-h" || arg == "--height") opt.height = std::atoi(value);
+        else if (arg == "-t" || arg == "--threads") opt.threads = std::atoi(value);
+        else if (arg == "-p" || arg == "--packets") opt.packets = std::atoi(value);
+        else if (arg == "-W" || arg == "--wavefront") opt.wavefront = std::atoi(value);
+        else if (arg == "--sort") opt.sort_rays = std::atoi(value);
+        else if (arg == "--occluder-cache") opt.occluder_cache = std::atoi(value);
+        else if (arg == "-d" || arg == "--depth") opt.depth = std::atoi(value);
+        else if (arg == "-r" || arg == "--roulette") opt.roulette = std::atoi(value);
+        else if (arg == "-l" || arg == "--light-samples") opt.light_samples = std::atoi(value);
+        else if (arg == "-a" || arg == "--aa-max") opt.aa_max = std::atoi(value);
+        else if (arg == "--aa-min") opt.aa_min = std::atoi(value);
+        else if (arg == "--aa-threshold") opt.aa_threshold = std::atof(value);
+        else if (arg == "-c" || arg == "--compact") opt.compact = std::atoi(value);
+        else if (arg == "-s" || arg == "--spp") opt.spp = std::atoi(value);
+        else if (arg == "-T" || arg == "--time") opt.time = std::atof(value);
+        else if (arg == "-o" || arg == "--output") opt.output = value;
+        else if (arg == "--trace") opt.trace = value;
+        else if (arg == "-S" || arg == "--scene") opt.scene = value;
+        else if (arg == "-m" || arg == "--model") opt.model = value;
+        else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return false;
+        }
+    }
+
+    return opt.width > 0 && opt.height > 0 && opt.threads >= 0 && opt.depth >= 0 &&
+           opt.light_samples >= 1 && opt.light_samples <= Scene::max_light_samples &&
+           opt.aa_min >= 1 && opt.aa_max >= 1;
+}
+
+int main(int argc, char *argv[]) {
+    Options opt;
+    if (!parseArgs(argc, argv, opt)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    auto s = createScene(opt.scene, opt.model);
+    if (!s) {
+        std::cerr << "Unknown scene: " << opt.scene << std::endl;
+        return 1;
+    }
+    s->threads = opt.threads;
+    s->packets = opt.packets;
+    s->wavefront = opt.wavefront;
+    s->sort_rays = opt.sort_rays;
+    s->occluder_cache = opt.occluder_cache;
+    s->max_depth = opt.depth;
+    s->roulette = opt.roulette;
+    s->light_samples = opt.light_samples;
+    s->aa_min_samples = opt.aa_min;
+    s->aa_max_samples = opt.aa_max;
+    s->aa_threshold = opt.aa_threshold;
+    for (Model *model : sceneModels(*s)) {
+        if (model->compact == opt.compact) continue;
+        model->compact = opt.compact;
+        model->build();
+    }
+    std::vector<unsigned char> pixel(opt.width * opt.height * 3);
+
+#ifdef RT_STATS
+    Stats::reset();
+#endif
+    auto start = std::chrono::steady_clock::now();
+    if (opt.spp > 0 || opt.time > 0) {
+        ProgressiveRenderer progressive(s, opt.width, opt.height);
+        progressive.max_samples = opt.spp > 0 ? opt.spp : 1 << 20;
+        progressive.time_budget = opt.time;
+        progressive.run();
+        progressive.resolve(pixel.data());
+        std::cout << progressive.passes << " passes, " << progressive.converged << " of "
+                  << opt.width * opt.height << " pixels converged" << std::endl;
+    }
+    else {
+        s->render(pixel.data(), opt.width, opt.height);
+        std::cout << (double)s->last_samples / (opt.width * opt.height) << " samples per pixel" << std::endl;
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "render: " << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl;
+
+#ifdef RT_STATS
+    Stats::print(std::cout);
+    if (!opt.trace.empty() && !Stats::writeTrace(opt.trace)) std::cerr << "Failed to write trace: " << opt.trace << std::endl;
+#else
+    if (!opt.trace.empty()) std::cerr << "--trace needs a build with -DRT_STATS=ON" << std::endl;
+#endif
+
+    if (!writeImage(opt.output, pixel.data(), opt.width, opt.height)) {
+        std::cerr << "Failed to write image: " << opt.output << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include "image.h"
+
+bool writePPM(const std::string &path, const unsigned char *pixel, int width, int height) {
+    std::ofstream ofs(path, std::ios::binary);
+    if (!ofs.is_open()) return false;
+
+    ofs << "P6\n" << width << ' ' << height << "\n255\n";
+    for (int y = height - 1; y >= 0; y--) {
+        ofs.write((const char *)pixel + y * width * 3, width * 3);
+    }
+
+    return ofs.good();
+}
+
+static uint32_t crc32(const uint8_t *data, size_t len, uint32_t crc = 0) {
+    static uint32_t table[256] = {0};
+    if (table[1] == 0) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    }
+
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void putU32(std::vector<uint8_t> &out, uint32_t v) {
+    out.push_back(v >> 24);
+    out.push_back(v >> 16);
+    out.push_back(v >> 8);
+    out.push_back(v);
+}
+
+static void putChunk(std::ofstream &ofs, const char *type, const std::vector<uint8_t> &data) {
+    std::vector<uint8_t> chunk;
+    putU32(chunk, data.size());
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    std::vector<uint8_t> crc;
+    putU32(crc, crc32(chunk.data() + 4, chunk.size() - 4));
+    ofs.write((const char *)chunk.data(), chunk.size());
+    ofs.write((const char *)crc.data(), crc.size());
+}
+
+/**
+ *  png without a compressor: the zlib stream only holds stored deflate blocks,
+ *  so files are about as large as the raw image but any viewer can open them
+ */
+bool writePNG(const std::string &path, const unsigned char *pixel, int width, int height) {
+    std::ofstream ofs(path, std::ios::binary);
+    if (!ofs.is_open()) return false;
+
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    ofs.write((const char *)signature, 8);
+
+    std::vector<uint8_t> header;
+    putU32(header, width);
+    putU32(header, height);
+    header.insert(header.end(), {8, 2, 0, 0, 0}); // 8 bit rgb, no interlace
+    putChunk(ofs, "IHDR", header);
+
+    // scanlines top-down, each one prefixed by filter type 0
+    std::vector<uint8_t> raw;
+    raw.reserve((size_t)(width * 3 + 1) * height);
+    for (int y = height - 1; y >= 0; y--) {
+        raw.push_back(0);
+        raw.insert(raw.end(), pixel + y * width * 3, pixel + (y + 1) * width * 3);
+    }
+
+    std::vector<uint8_t> z = {0x78, 0x01};
+    uint32_t a = 1, b = 0;
+    for (size_t pos = 0; pos < raw.size() || pos == 0;) {
+        size_t len = std::min<size_t>(65535, raw.size() - pos);
+        bool last = pos + len == raw.size();
+        z.push_back(last);
+        z.insert(z.end(), {uint8_t(len), uint8_t(len >> 8), uint8_t(~len), uint8_t(~len >> 8)});
+        z.insert(z.end(), raw.begin() + pos, raw.begin() + pos + len);
+        for (size_t i = pos; i < pos + len; i++) {
+            a = (a + raw[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        pos += len;
+        if (last) break;
+    }
+    putU32(z, b << 16 | a); // adler32 of the uncompressed data
+    putChunk(ofs, "IDAT", z);
+    putChunk(ofs, "IEND", {});
+
+    return ofs.good();
+}
+
+bool writeImage(const std::string &path, const unsigned char *pixel, int width, int height) {
+    auto dot = path.rfind('.');
+    std::string ext = dot == std::string::npos ? "" : path.substr(dot + 1);
+    if (ext == "ppm") return writePPM(path, pixel, width, height);
+    if (ext == "png") return writePNG(path, pixel, width, height);
+
+    std::cerr << "Unsupported image format: " << path << std::endl;
+    return false;
+}
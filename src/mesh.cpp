@@ -1,4 +1,43 @@
 #include "mesh.h"
+#include <bit>
+
+unsigned Mesh::intersection(const RayPacket &packet, PacketHit &hit) {
+    unsigned mask = 0;
+    for (int l = 0; l < packet.count; l++) {
+        Hit temp_hit = intersection(packet.get(l));
+        float t = temp_hit.t;
+        if (fequal(t, -1) || t >= hit.t[l]) continue;
+
+        hit.t[l] = t;
+        hit.normal[l] = temp_hit.normal;
+        mask |= 1u << l;
+    }
+
+    return mask;
+}
+
+unsigned Mesh::occluded(const RayPacket &packet, float t_min, const float *t_max, unsigned active) {
+    unsigned mask = 0;
+    for (int l = 0; l < packet.count; l++) {
+        if ((active >> l & 1) && occluded(packet.get(l), t_min, t_max[l])) mask |= 1u << l;
+    }
+
+    return mask;
+}
+
+bool Mesh::occluded(const Ray &ray, float t_min, float t_max, int &part) {
+    part = -1;
+    return occluded(ray, t_min, t_max);
+}
+
+unsigned Mesh::occluded(const RayPacket &packet, float t_min, const float *t_max, unsigned active, int *part) {
+    for (int l = 0; l < RayPacket::size; l++) part[l] = -1;
+    return occluded(packet, t_min, t_max, active);
+}
+
+bool Mesh::partOccluded(int part, const Ray &ray, float t_min, float t_max) {
+    return occluded(ray, t_min, t_max);
+}
 
 /**
  *  sphere: (x - xc)^2 + (y - yc)^2 + (z - zc)^2 = r^2
@@ -7,6 +46,7 @@
  *  -> At^2 + Bt + C = 0
  */
 Hit Sphere::intersection(const Ray &ray) {
+    RT_COUNT(sphere_tests, 1);
     float xd = ray.dir.x, yd = ray.dir.y, zd = ray.dir.z;
     float xp = ray.start.x, yp = ray.start.y, zp = ray.start.z;
     float xc = center.x, yc = center.y, zc = center.z;
@@ -16,20 +56,69 @@ Hit Sphere::intersection(const Ray &ray) {
     float delta = B * B - 4 * C;
 
     // no intersection point
-    if (delta < 0) return Hit(Point::none, Vector3D::zero, -1);
+    if (delta < 0) return Hit();
 
     delta = std::sqrt(delta);
     float t1 = (-B + delta) / 2.0f;
     float t2 = (-B - delta) / 2.0f;
 
     // t < 0 means the intersection point is in the opposite side of the ray
-    if (t1 < Ray::offset) return Hit(Point::none, Vector3D::zero, -1);
+    if (t1 < Ray::offset) return Hit();
     float t = t2 < Ray::offset ? t1 : t2;
 
     Point point = ray.start + t * ray.dir;
     Vector3D dir = (point - center).normalized();
 
-    return Hit(point, dir, t);
+    return Hit{point, dir, t};
+}
+
+bool Sphere::occluded(const Ray &ray, float t_min, float t_max) {
+    RT_COUNT(sphere_tests, 1);
+    Vector3D d = ray.start - center;
+    float B = 2 * Vector3D::dot(ray.dir, d);
+    float C = d.sqrMagnitude() - radius * radius;
+    float delta = B * B - 4 * C;
+    if (delta < 0) return false;
+
+    // either root inside the range blocks the ray
+    delta = std::sqrt(delta);
+    float t1 = (-B + delta) / 2.0f;
+    float t2 = (-B - delta) / 2.0f;
+    return (t2 >= t_min && t2 < t_max) || (t1 >= t_min && t1 < t_max);
+}
+
+unsigned Sphere::intersection(const RayPacket &packet, PacketHit &hit) {
+    RT_COUNT(sphere_tests, packet.count);
+    alignas(32) float t[RayPacket::size];
+    sphereDistance(center, radius, packet, Ray::offset, t);
+
+    unsigned mask = 0;
+    for (int l = 0; l < packet.count; l++) {
+        if (t[l] >= hit.t[l]) continue;
+
+        hit.t[l] = t[l];
+        Point p(packet.ox[l] + t[l] * packet.dx[l], packet.oy[l] + t[l] * packet.dy[l], packet.oz[l] + t[l] * packet.dz[l]);
+        hit.normal[l] = (p - center).normalized();
+        mask |= 1u << l;
+    }
+
+    return mask;
+}
+
+unsigned Sphere::occluded(const RayPacket &packet, float t_min, const float *t_max, unsigned active) {
+    RT_COUNT(sphere_tests, std::popcount(active));
+    alignas(32) float t[RayPacket::size];
+    sphereDistance(center, radius, packet, t_min, t);
+
+    unsigned mask = 0;
+    for (int l = 0; l < RayPacket::size; l++) mask |= (t[l] < t_max[l]) << l;
+    return mask & active;
+}
+
+AABB Sphere::bounds() const {
+    Vector3D c(center.x, center.y, center.z);
+    Vector3D r(radius, radius, radius);
+    return AABB(c - r, c + r);
 }
 
 /**
@@ -39,15 +128,16 @@ Hit Sphere::intersection(const Ray &ray) {
  *  -> t = (start - P0) dot n / dir dot n, P0 is one of face's points
  */
 Hit Plane::intersection(const Ray &ray) {
+    RT_COUNT(plane_tests, 1);
     Vector3D n = Vector3D::cross(right, up).normalized();
     float divisor = Vector3D::dot(ray.dir, n);
 
     // check if the ray and the face are parallel
-    if (fequal(divisor, 0)) return Hit(Point::none, Vector3D::zero, -1);
+    if (fequal(divisor, 0)) return Hit();
 
     // t < 0 means the intersection point is in the opposite side of the ray
     float t = -Vector3D::dot(ray.start - lb, n) / divisor;
-    if (t < Ray::offset) return Hit(Point::none, Vector3D::zero, -1);
+    if (t < Ray::offset) return Hit();
 
     Point hit_point = ray.start + t * ray.dir;
 
@@ -58,47 +148,383 @@ Hit Plane::intersection(const Ray &ray) {
 
     // check up direction
     float len = Vector3D::dot(v, up) / up_len;
-    if (len < 0 || len > up_len) return Hit(Point::none, Vector3D::zero, -1);
+    if (len < 0 || len > up_len) return Hit();
 
     // check right direction
     len = Vector3D::dot(v, right) / right_len;
-    if (len < 0 || len > right_len) return Hit(Point::none, Vector3D::zero, -1);
-    return Hit(hit_point, n, t);
+    if (len < 0 || len > right_len) return Hit();
+    return Hit{hit_point, n, t};
+}
+
+bool Plane::occluded(const Ray &ray, float t_min, float t_max) {
+    RT_COUNT(plane_tests, 1);
+    Vector3D n = Vector3D::cross(right, up);
+    float divisor = Vector3D::dot(ray.dir, n);
+    if (fequal(divisor, 0)) return false;
+
+    float t = -Vector3D::dot(ray.start - lb, n) / divisor;
+    if (t < t_min || t >= t_max) return false;
+
+    // compare the projections with the squared lengths, so no sqrt is needed
+    Vector3D v = ray.start + t * ray.dir - lb;
+    float len = Vector3D::dot(v, up);
+    if (len < 0 || len > up.sqrMagnitude()) return false;
+
+    len = Vector3D::dot(v, right);
+    return len >= 0 && len <= right.sqrMagnitude();
+}
+
+unsigned Plane::intersection(const RayPacket &packet, PacketHit &hit) {
+    RT_COUNT(plane_tests, packet.count);
+    alignas(32) float t[RayPacket::size];
+    planeDistance(lb, right, up, packet, Ray::offset, t);
+
+    unsigned mask = 0;
+    Vector3D n = Vector3D::cross(right, up).normalized();
+    for (int l = 0; l < packet.count; l++) {
+        if (t[l] >= hit.t[l]) continue;
+
+        hit.t[l] = t[l];
+        hit.normal[l] = n;
+        mask |= 1u << l;
+    }
+
+    return mask;
+}
+
+unsigned Plane::occluded(const RayPacket &packet, float t_min, const float *t_max, unsigned active) {
+    RT_COUNT(plane_tests, std::popcount(active));
+    alignas(32) float t[RayPacket::size];
+    planeDistance(lb, right, up, packet, t_min, t);
+
+    unsigned mask = 0;
+    for (int l = 0; l < RayPacket::size; l++) mask |= (t[l] < t_max[l]) << l;
+    return mask & active;
+}
+
+AABB Plane::bounds() const {
+    AABB box;
+    box.expand(lb);
+    box.expand(lb + right);
+    box.expand(lb + up);
+    box.expand(lb + right + up);
+    return box;
+}
+
+void Model::addFace(const Face &f) {
+    int first = vertex.size();
+    vertex.insert(vertex.end(), f.vertex.begin(), f.vertex.end());
+    for (int i = 1; i + 1 < f.v_counts; i++) {
+        index.insert(index.end(), {first, first + i, first + i + 1});
+    }
+}
+
+void Model::build() {
+    // drop degenerate triangles, they can't be hit and have no normal
+    std::vector<Triangle> tris;
+    std::vector<int> tri_index;
+    for (int i = 0; i + 2 < (int)index.size(); i += 3) {
+        Triangle tri(vertex[index[i]], vertex[index[i + 1]], vertex[index[i + 2]]);
+        if (tri.degenerate()) continue;
+        tris.emplace_back(tri);
+        tri_index.insert(tri_index.end(), {index[i], index[i + 1], index[i + 2]});
+    }
+
+    std::vector<AABB> boxes;
+    boxes.reserve(tris.size());
+    for (auto &tri : tris) boxes.emplace_back(tri.bounds());
+    bvh.build(boxes, builder, build_threads);
+
+    // store triangles in leaf order, so leaves read contiguous memory
+    std::vector<Triangle> ordered(tris.size());
+    std::vector<int> identity(bvh.index.size());
+    index.resize(tri_index.size());
+    for (int i = 0; i < (int)bvh.index.size(); i++) {
+        int src = bvh.index[i];
+        ordered[i] = tris[src];
+        std::copy(tri_index.begin() + src * 3, tri_index.begin() + src * 3 + 3, index.begin() + i * 3);
+        identity[i] = i;
+    }
+    triangle = Buffer<Triangle>(std::move(ordered));
+    bvh.index = Buffer<int>(std::move(identity));
+    mapping = nullptr;
+
+    wide = WideBVH();
+    if (compact) {
+        wide.build(bvh, vertex, index);
+        triangle = Buffer<Triangle>();
+        bvh = BVH();
+    }
+}
+
+size_t Model::geometryBytes() const {
+    if (compact) return wide.bytes();
+    return triangle.size() * sizeof(Triangle) + bvh.nodes.size() * sizeof(BVH::Node) + bvh.index.size() * sizeof(int);
+}
+
+/**
+ *  Möller–Trumbore: solve start + t * dir = v0 + u * e1 + v * e2 by cramer's rule
+ *  return the distance in [t_min, t_max) or -1
+ */
+static float triangleIntersection(const Vector3D &v0, const Vector3D &e1, const Vector3D &e2, const Ray &ray, float t_min, float t_max) {
+    Vector3D p = Vector3D::cross(ray.dir, e2);
+    float det = Vector3D::dot(e1, p);
+
+    // check if the ray and the triangle are parallel
+    if (fequal(det, 0)) return -1;
+
+    float inv_det = 1 / det;
+    Vector3D s(ray.start.x - v0.x, ray.start.y - v0.y, ray.start.z - v0.z);
+    float u = Vector3D::dot(s, p) * inv_det;
+    if (u < 0 || u > 1) return -1;
+
+    Vector3D q = Vector3D::cross(s, e1);
+    float v = Vector3D::dot(ray.dir, q) * inv_det;
+    if (v < 0 || u + v > 1) return -1;
+
+    float t = Vector3D::dot(e2, q) * inv_det;
+    return t >= t_min && t < t_max ? t : -1;
+}
+
+static float triangleIntersection(const Triangle &tri, const Ray &ray, float t_min, float t_max) {
+    return triangleIntersection(tri.v0, tri.e1, tri.e2, ray, t_min, t_max);
+}
+
+// a triangle of a wide bvh block, the edges are the ones Triangle would precompute
+static float triangleIntersection(const Point &a, const Point &b, const Point &c, const Ray &ray, float t_min, float t_max) {
+    return triangleIntersection(Vector3D(a.x, a.y, a.z), b - a, c - a, ray, t_min, t_max);
+}
+
+// closest hit in the compact layout
+static Hit wideIntersection(const WideBVH &wide, const Ray &ray) {
+    bool hit = false;
+    Point corner[3];
+    float t_max = FLOAT_MAX;
+    wide.traverse(ray, t_max, [&](const Point &a, const Point &b, const Point &c) {
+        RT_COUNT(triangle_tests, 1);
+        float t = triangleIntersection(a, b, c, ray, Ray::offset, t_max);
+        if (t < 0) return;
+
+        corner[0] = a;
+        corner[1] = b;
+        corner[2] = c;
+        hit = true;
+        t_max = t;
+    });
+
+    if (!hit) return Hit();
+    return Hit{ray.start + t_max * ray.dir, Triangle(corner[0], corner[1], corner[2]).n, t_max};
 }
 
 Hit Model::intersection(const Ray &ray) {
-    Hit hit(Point::none, Vector3D::zero, -1);
-    float dist = -1;
-    bool first_hit = false;
-    for (auto &f : face) {
-        Vector3D n = f.normal();
-        float divisor = Vector3D::dot(ray.dir, n);
-
-        // check if the ray and the face are parallel
-        if (fequal(divisor, 0)) continue;
-
-        // t < 0 means the intersection point is in the opposite side of the ray
-        float t = -Vector3D::dot(ray.start - f.vertex[0], n) / divisor;
-        if (t < Ray::offset || first_hit && dist < t) continue;
-
-        // check if the point is in the face
-        Point hit_point = ray.start + t * ray.dir;
-        bool inside = true;
-        for (int i = 0; i < f.v_counts; i++) {
-            Vector3D v = hit_point - f.vertex[i];
-            int next = (i + 1) % f.v_counts;
-            Vector3D v1 = f.vertex[next] - f.vertex[i];
-            if (Vector3D::dot(Vector3D::cross(v1, v), n) < 0) {
-                inside = false;
-                break;
-            }
+    if (compact) return wideIntersection(wide, ray);
+
+    int hit_triangle = -1;
+    float t_max = FLOAT_MAX;
+    bvh.traverse(ray, t_max, [&](int i) {
+        RT_COUNT(triangle_tests, 1);
+        float t = triangleIntersection(triangle[i], ray, Ray::offset, t_max);
+        if (t < 0) return;
+
+        hit_triangle = i;
+        t_max = t;
+    });
+
+    if (hit_triangle == -1) return Hit();
+    return Hit{ray.start + t_max * ray.dir, triangle[hit_triangle].n, t_max};
+}
+
+bool Model::occluded(const Ray &ray, float t_min, float t_max) {
+    if (compact) {
+        return wide.occluded(ray, t_max, [&](const Point &a, const Point &b, const Point &c) {
+            RT_COUNT(triangle_tests, 1);
+            return triangleIntersection(a, b, c, ray, t_min, t_max) >= 0;
+        });
+    }
+
+    return bvh.occluded(ray, t_max, [&](int i) {
+        RT_COUNT(triangle_tests, 1);
+        return triangleIntersection(triangle[i], ray, t_min, t_max) >= 0;
+    });
+}
+
+unsigned Model::intersection(const RayPacket &packet, PacketHit &hit) {
+    if (compact) return Mesh::intersection(packet, hit);
+
+    unsigned mask = 0;
+    bvh.traverse(packet, hit.t, [&](int i) {
+        alignas(32) float t[RayPacket::size];
+        RT_COUNT(triangle_tests, packet.count);
+        triangleDistance(triangle[i], packet, Ray::offset, t);
+
+        for (int l = 0; l < packet.count; l++) {
+            if (t[l] >= hit.t[l]) continue;
+
+            hit.t[l] = t[l];
+            hit.normal[l] = triangle[i].n;
+            mask |= 1u << l;
+        }
+    });
+
+    return mask;
+}
+
+unsigned Model::occluded(const RayPacket &packet, float t_min, const float *t_max, unsigned active) {
+    if (compact) return Mesh::occluded(packet, t_min, t_max, active);
+
+    return bvh.occluded(packet, t_max, active, [&](int i, unsigned lanes) {
+        alignas(32) float t[RayPacket::size];
+        RT_COUNT(triangle_tests, std::popcount(lanes));
+        triangleDistance(triangle[i], packet, t_min, t);
+
+        unsigned mask = 0;
+        for (int l = 0; l < RayPacket::size; l++) mask |= (t[l] < t_max[l]) << l;
+        return mask & lanes;
+    });
+}
+
+bool Model::occluded(const Ray &ray, float t_min, float t_max, int &part) {
+    // the wide bvh doesn't keep triangle indices
+    part = -1;
+    if (compact) return occluded(ray, t_min, t_max);
+
+    return bvh.occluded(ray, t_max, [&](int i) {
+        RT_COUNT(triangle_tests, 1);
+        if (triangleIntersection(triangle[i], ray, t_min, t_max) < 0) return false;
+        part = i;
+        return true;
+    });
+}
+
+unsigned Model::occluded(const RayPacket &packet, float t_min, const float *t_max, unsigned active, int *part) {
+    for (int l = 0; l < RayPacket::size; l++) part[l] = -1;
+    if (compact) return Mesh::occluded(packet, t_min, t_max, active);
+
+    return bvh.occluded(packet, t_max, active, [&](int i, unsigned lanes) {
+        alignas(32) float t[RayPacket::size];
+        RT_COUNT(triangle_tests, std::popcount(lanes));
+        triangleDistance(triangle[i], packet, t_min, t);
+
+        unsigned mask = 0;
+        for (int l = 0; l < RayPacket::size; l++) {
+            if (!(lanes >> l & 1) || t[l] >= t_max[l]) continue;
+            mask |= 1u << l;
+            part[l] = i;
         }
+        return mask;
+    });
+}
+
+bool Model::partOccluded(int part, const Ray &ray, float t_min, float t_max) {
+    if (compact || part < 0 || part >= (int)triangle.size()) return occluded(ray, t_min, t_max);
+    RT_COUNT(triangle_tests, 1);
+    return triangleIntersection(triangle[part], ray, t_min, t_max) >= 0;
+}
+
+AABB Model::bounds() const {
+    if (compact) return wide.box;
+    return bvh.empty() ? AABB() : bvh.nodes[0].box;
+}
+Ray Instance::toMesh(const Ray &ray, float &scale) const {
+    Ray ret;
+    ret.start = inverse.apply(ray.start);
+    ret.dir = inverse.apply(ray.dir);
+    scale = ret.dir.magnitude();
+    ret.dir = ret.dir / scale;
+    return ret;
+}
+
+RayPacket Instance::toMesh(const RayPacket &packet, float *scale) const {
+    RayPacket ret;
+    ret.count = packet.count;
+    for (int l = 0; l < RayPacket::size; l++) ret.set(l, toMesh(packet.get(l), scale[l]));
+    return ret;
+}
 
-        if (!inside) continue;
-        hit = Hit(hit_point, n, t);
-        dist = t;
-        if (!first_hit) first_hit = true;
+Hit Instance::intersection(const Ray &ray) {
+    float scale;
+    Hit hit = mesh->intersection(toMesh(ray, scale));
+    if (hit.missed()) return hit;
+
+    float t = hit.t / scale;
+    return Hit{ray.start + t * ray.dir, inverse.applyNormal(hit.normal).normalized(), t};
+}
+
+bool Instance::occluded(const Ray &ray, float t_min, float t_max) {
+    float scale;
+    Ray local = toMesh(ray, scale);
+    return mesh->occluded(local, t_min * scale, t_max * scale);
+}
+
+unsigned Instance::intersection(const RayPacket &packet, PacketHit &hit) {
+    float scale[RayPacket::size];
+    RayPacket local = toMesh(packet, scale);
+
+    // the closest hit so far, in mesh space
+    PacketHit local_hit(local);
+    for (int l = 0; l < packet.count; l++) {
+        if (hit.t[l] < FLOAT_MAX) local_hit.t[l] = hit.t[l] * scale[l];
+    }
+
+    unsigned mask = mesh->intersection(local, local_hit);
+    for (int l = 0; l < packet.count; l++) {
+        if (!(mask >> l & 1)) continue;
+        hit.t[l] = local_hit.t[l] / scale[l];
+        hit.normal[l] = inverse.applyNormal(local_hit.normal[l]).normalized();
     }
 
-    return hit;
-}
\ No newline at end of file
+    return mask;
+}
+
+unsigned Instance::occluded(const RayPacket &packet, float t_min, const float *t_max, unsigned active) {
+    // t_min is one value for the whole packet, use the smallest of the lanes' mesh space values,
+    // it only keeps shadow rays off the surface they start from
+    float scale[RayPacket::size];
+    RayPacket local = toMesh(packet, scale);
+
+    alignas(32) float local_t_max[RayPacket::size];
+    float local_t_min = FLOAT_MAX;
+    for (int l = 0; l < RayPacket::size; l++) {
+        local_t_max[l] = t_max[l] * scale[l];
+        if (active >> l & 1) local_t_min = std::min(local_t_min, t_min * scale[l]);
+    }
+
+    return mesh->occluded(local, local_t_min, local_t_max, active);
+}
+
+bool Instance::occluded(const Ray &ray, float t_min, float t_max, int &part) {
+    float scale;
+    Ray local = toMesh(ray, scale);
+    return mesh->occluded(local, t_min * scale, t_max * scale, part);
+}
+
+unsigned Instance::occluded(const RayPacket &packet, float t_min, const float *t_max, unsigned active, int *part) {
+    // same t_min as the plain packet version
+    float scale[RayPacket::size];
+    RayPacket local = toMesh(packet, scale);
+
+    alignas(32) float local_t_max[RayPacket::size];
+    float local_t_min = FLOAT_MAX;
+    for (int l = 0; l < RayPacket::size; l++) {
+        local_t_max[l] = t_max[l] * scale[l];
+        if (active >> l & 1) local_t_min = std::min(local_t_min, t_min * scale[l]);
+    }
+
+    return mesh->occluded(local, local_t_min, local_t_max, active, part);
+}
+
+bool Instance::partOccluded(int part, const Ray &ray, float t_min, float t_max) {
+    float scale;
+    Ray local = toMesh(ray, scale);
+    return mesh->partOccluded(part, local, t_min * scale, t_max * scale);
+}
+
+AABB Instance::bounds() const {
+    AABB box = mesh->bounds();
+    AABB ret;
+    for (int i = 0; i < 8; i++) {
+        Point corner(i & 1 ? box.max.x : box.min.x, i & 2 ? box.max.y : box.min.y, i & 4 ? box.max.z : box.min.z);
+        ret.expand(transform.apply(corner));
+    }
+    return ret;
+}
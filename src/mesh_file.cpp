@@ -0,0 +1,78 @@
+#include <fstream>
+#include <cstring>
+#include <type_traits>
+#include "mesh_file.h"
+
+static_assert(std::is_trivially_copyable_v<Triangle> && std::is_trivially_copyable_v<BVH::Node>);
+
+static uint64_t alignUp(uint64_t offset) {
+    return (offset + 63) / 64 * 64;
+}
+
+bool saveModel(const Model &model, const std::string &path) {
+    if (model.compact) return false;
+
+    MeshFileHeader header = {};
+    memcpy(header.magic, MeshFileHeader::magic_value, sizeof(header.magic));
+    header.version = MeshFileHeader::current_version;
+    header.endian = 0x01020304;
+    header.triangle_size = sizeof(Triangle);
+    header.node_size = sizeof(BVH::Node);
+    header.triangle_count = model.triangle.size();
+    header.node_count = model.bvh.nodes.size();
+    header.index_count = model.bvh.index.size();
+    header.triangle_offset = alignUp(sizeof(MeshFileHeader));
+    header.node_offset = alignUp(header.triangle_offset + header.triangle_count * sizeof(Triangle));
+    header.index_offset = alignUp(header.node_offset + header.node_count * sizeof(BVH::Node));
+
+    std::ofstream ofs(path, std::ios::binary);
+    if (!ofs.is_open()) return false;
+
+    auto writeAt = [&](uint64_t offset, const void *data, uint64_t size) {
+        static const char zeros[64] = {0};
+        ofs.write(zeros, offset - ofs.tellp()); // padding up to the aligned offset
+        ofs.write((const char *)data, size);
+    };
+    ofs.write((const char *)&header, sizeof(header));
+    writeAt(header.triangle_offset, model.triangle.data(), header.triangle_count * sizeof(Triangle));
+    writeAt(header.node_offset, model.bvh.nodes.data(), header.node_count * sizeof(BVH::Node));
+    writeAt(header.index_offset, model.bvh.index.data(), header.index_count * sizeof(int));
+
+    return ofs.good();
+}
+
+std::shared_ptr<Model> loadModel(const std::string &path) {
+    auto file = std::make_shared<MappedFile>();
+    if (!file->open(path) || file->size() < sizeof(MeshFileHeader)) {
+        std::cerr << "Failed to load mesh file: " << path << std::endl;
+        return nullptr;
+    }
+
+    MeshFileHeader header;
+    memcpy(&header, file->data(), sizeof(header));
+    if (memcmp(header.magic, MeshFileHeader::magic_value, sizeof(header.magic)) != 0 ||
+        header.version != MeshFileHeader::current_version || header.endian != 0x01020304 ||
+        header.triangle_size != sizeof(Triangle) || header.node_size != sizeof(BVH::Node)) {
+        std::cerr << "Incompatible mesh file: " << path << std::endl;
+        return nullptr;
+    }
+
+    auto inside = [&](uint64_t offset, uint64_t count, uint64_t size) {
+        return offset % 64 == 0 && offset <= file->size() && count <= (file->size() - offset) / size;
+    };
+    if (!inside(header.triangle_offset, header.triangle_count, sizeof(Triangle)) ||
+        !inside(header.node_offset, header.node_count, sizeof(BVH::Node)) ||
+        !inside(header.index_offset, header.index_count, sizeof(int))) {
+        std::cerr << "Truncated mesh file: " << path << std::endl;
+        return nullptr;
+    }
+
+    auto model = std::make_shared<Model>();
+    const char *base = file->data();
+    model->triangle = Buffer<Triangle>::borrow((const Triangle *)(base + header.triangle_offset), header.triangle_count);
+    model->bvh.nodes = Buffer<BVH::Node>::borrow((const BVH::Node *)(base + header.node_offset), header.node_count);
+    model->bvh.index = Buffer<int>::borrow((const int *)(base + header.index_offset), header.index_count);
+    model->mapping = file;
+
+    return model;
+}
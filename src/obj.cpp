@@ -1,42 +1,314 @@
+#include <thread>
+#include <cstring>
+#include <cstdint>
 #include "obj.h"
+#include "mapped_file.h"
 
-OBJ::OBJ(std::string path, float x_offs, float y_offs, float z_offs, float scale) {
-    std::ifstream ifs(path, std::ios::in);
-    if (!ifs.is_open()) {
-        std::cerr << "Failed to load obj: " << path << std::endl;
-        return;
+namespace {
+
+// state changes from o, g and usemtl lines
+struct GroupEvent {
+    int triangle; // first triangle after the line
+    bool material;
+    std::string name;
+};
+
+// result of parsing one chunk of the file, indices are global, except for corners listed in fix_*
+struct Chunk {
+    std::vector<Point> vertex;
+    std::vector<Vector3D> normal;
+    std::vector<float> texcoord;
+    std::vector<int> triangle;
+    std::vector<int> triangle_texcoord;
+    std::vector<int> triangle_normal;
+    std::vector<GroupEvent> events;
+
+    // corners with negative indices only know their position relative to this chunk,
+    // the counts of earlier chunks are added when merging
+    std::vector<int> fix_vertex;
+    std::vector<int> fix_texcoord;
+    std::vector<int> fix_normal;
+
+    // corners of the current face, reused between faces
+    std::vector<int> corner[3];
+    std::vector<bool> relative[3];
+};
+
+inline bool isBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+const char *skipBlank(const char *p, const char *end) {
+    while (p < end && isBlank(*p)) p++;
+    return p;
+}
+
+const char *nextLine(const char *p, const char *end) {
+    const char *nl = (const char *)memchr(p, '\n', end - p);
+    return nl ? nl + 1 : end;
+}
+
+// parse [+-]digits[.digits][(e|E)[+-]digits], return nullptr if there are no digits
+const char *parseFloat(const char *p, const char *end, float &out) {
+    static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    bool digits = false;
+    for (; p < end && isDigit(*p); p++, digits = true) {
+        if (mantissa < 100000000000000000ull) mantissa = mantissa * 10 + (*p - '0');
+        else exponent++;
     }
+    if (p < end && *p == '.') {
+        for (p++; p < end && isDigit(*p); p++, digits = true) {
+            if (mantissa < 100000000000000000ull) {
+                mantissa = mantissa * 10 + (*p - '0');
+                exponent--;
+            }
+        }
+    }
+    if (!digits) return nullptr;
 
-    std::string line;
-    std::stringstream ss;
-    while (std::getline(ifs, line)) {
-        if (line.empty() || line[0] == '#') continue;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        bool exp_negative = false;
+        if (q < end && (*q == '-' || *q == '+')) exp_negative = *q++ == '-';
+        if (q < end && isDigit(*q)) {
+            int e = 0;
+            for (; q < end && isDigit(*q); q++) e = std::min(e * 10 + (*q - '0'), 1000);
+            exponent += exp_negative ? -e : e;
+            p = q;
+        }
+    }
+
+    double value = mantissa;
+    int e = std::abs(exponent);
+    double scale = e <= 22 ? pow10[e] : std::pow(10.0, e);
+    value = exponent < 0 ? value / scale : value * scale;
+    out = negative ? -value : value;
+    return p;
+}
+
+const char *parseInt(const char *p, const char *end, int &out) {
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    if (p >= end || !isDigit(*p)) return nullptr;
+
+    int value = 0;
+    for (; p < end && isDigit(*p); p++) value = value * 10 + (*p - '0');
+    out = negative ? -value : value;
+    return p;
+}
+
+std::string restOfLine(const char *p, const char *end) {
+    p = skipBlank(p, end);
+    const char *e = p;
+    while (e < end && *e != '\n' && *e != '#') e++;
+    while (e > p && isBlank(e[-1])) e--;
+    return std::string(p, e);
+}
+
+bool startsWith(const char *p, const char *end, const char *word) {
+    size_t len = strlen(word);
+    return (size_t)(end - p) > len && memcmp(p, word, len) == 0 && isBlank(p[len]);
+}
+
+// f v, f v/vt, f v//vn, f v/vt/vn, return false if the face is malformed
+bool parseFace(const char *p, const char *end, Chunk &c) {
+    int counts[3] = {(int)c.vertex.size(), (int)c.texcoord.size() / 2, (int)c.normal.size()};
+    for (int k = 0; k < 3; k++) {
+        c.corner[k].clear();
+        c.relative[k].clear();
+    }
 
-        ss.str("");
-        ss << line;
-        std::string type;
-        ss >> type;
+    while (true) {
+        p = skipBlank(p, end);
+        if (p >= end || *p == '\n' || *p == '#') break;
 
-        if (type == "v") {
-            float x, y, z;
-            ss >> x >> y >> z;
-            vertex.emplace_back(x * scale + x_offs, y * scale + y_offs, z * scale + z_offs);
+        int idx[3] = {0, 0, 0};
+        p = parseInt(p, end, idx[0]);
+        if (!p) return false;
+        for (int k = 1; k < 3 && p < end && *p == '/'; k++) {
+            p++;
+            if (p < end && *p != '/' && !isBlank(*p) && *p != '\n') {
+                p = parseInt(p, end, idx[k]);
+                if (!p) return false;
+            }
+        }
+        if (idx[0] == 0) return false;
+
+        // positive indices are 1-based and global, negative ones count back from the latest element
+        for (int k = 0; k < 3; k++) {
+            bool rel = idx[k] < 0;
+            c.corner[k].push_back(idx[k] > 0 ? idx[k] - 1 : (rel ? counts[k] + idx[k] : -1));
+            c.relative[k].push_back(rel);
         }
-        else if (type == "f") {
-            int idx;
-            std::vector<int> v;
-            while (ss >> idx) {
-                v.emplace_back(idx - 1);
+    }
+
+    int n = c.corner[0].size();
+    if (n < 3) return false;
+
+    // (v0, v1, v2), (v0, v2, v3) ...
+    std::vector<int> *out[3] = {&c.triangle, &c.triangle_texcoord, &c.triangle_normal};
+    std::vector<int> *fix[3] = {&c.fix_vertex, &c.fix_texcoord, &c.fix_normal};
+    for (int i = 1; i + 1 < n; i++) {
+        for (int corner : {0, i, i + 1}) {
+            for (int k = 0; k < 3; k++) {
+                if (c.relative[k][corner]) fix[k]->push_back(out[k]->size());
+                out[k]->push_back(c.corner[k][corner]);
             }
+        }
+    }
 
-            Face f(v.size());
-            for (auto i : v) {
-                f.vertex.emplace_back(vertex[i]);
+    return true;
+}
+
+void parseChunk(const char *p, const char *end, Chunk &c, float x_offs, float y_offs, float z_offs, float scale) {
+    for (; p < end; p = nextLine(p, end)) {
+        p = skipBlank(p, end);
+        if (p >= end || *p == '\n' || *p == '#') continue;
+
+        if (startsWith(p, end, "v")) {
+            float x = 0, y = 0, z = 0;
+            const char *q = skipBlank(p + 1, end);
+            if ((q = parseFloat(q, end, x)) && (q = parseFloat(skipBlank(q, end), end, y)) && parseFloat(skipBlank(q, end), end, z)) {
+                c.vertex.emplace_back(x * scale + x_offs, y * scale + y_offs, z * scale + z_offs);
+            }
+            else {
+                c.vertex.emplace_back(x_offs, y_offs, z_offs); // keep the numbering of later vertices
             }
-            face.emplace_back(f);
         }
+        else if (startsWith(p, end, "vt")) {
+            float u = 0, v = 0;
+            const char *q = parseFloat(skipBlank(p + 2, end), end, u);
+            if (q) parseFloat(skipBlank(q, end), end, v);
+            c.texcoord.insert(c.texcoord.end(), {u, v});
+        }
+        else if (startsWith(p, end, "vn")) {
+            float x = 0, y = 0, z = 0;
+            const char *q = skipBlank(p + 2, end);
+            if ((q = parseFloat(q, end, x)) && (q = parseFloat(skipBlank(q, end), end, y))) parseFloat(skipBlank(q, end), end, z);
+            c.normal.emplace_back(x, y, z);
+        }
+        else if (startsWith(p, end, "f")) {
+            size_t before = c.triangle.size();
+            if (!parseFace(p + 1, end, c)) {
+                // drop whatever a malformed face left behind
+                c.triangle.resize(before);
+                c.triangle_texcoord.resize(before);
+                c.triangle_normal.resize(before);
+                for (auto *fix : {&c.fix_vertex, &c.fix_texcoord, &c.fix_normal}) {
+                    while (!fix->empty() && fix->back() >= (int)before) fix->pop_back();
+                }
+            }
+        }
+        else if (startsWith(p, end, "o") || startsWith(p, end, "g")) {
+            c.events.push_back({(int)c.triangle.size() / 3, false, restOfLine(p + 1, end)});
+        }
+        else if (startsWith(p, end, "usemtl")) {
+            c.events.push_back({(int)c.triangle.size() / 3, true, restOfLine(p + 6, end)});
+        }
+    }
+}
+
+} // namespace
+
+OBJ::OBJ(std::string path, float x_offs, float y_offs, float z_offs, float scale, int threads) {
+    MappedFile file;
+    if (!file.open(path)) {
+        std::cerr << "Failed to load obj: " << path << std::endl;
+        return;
+    }
+
+    const char *begin = file.data(), *end = file.data() + file.size();
+
+    // small files aren't worth the threads
+    constexpr size_t min_chunk = 1 << 20;
+    int chunk_count = std::max(1, std::min<int>(threads, file.size() / min_chunk));
+
+    // chunk borders are moved to the start of the next line
+    std::vector<const char *> border(chunk_count + 1, end);
+    border[0] = begin;
+    for (int i = 1; i < chunk_count; i++) {
+        border[i] = std::max(border[i - 1], nextLine(begin + file.size() / chunk_count * i, end));
+    }
+
+    std::vector<Chunk> chunks(chunk_count);
+    if (chunk_count == 1) {
+        parseChunk(begin, end, chunks[0], x_offs, y_offs, z_offs, scale);
+    }
+    else {
+        std::vector<std::thread> workers;
+        for (int i = 0; i < chunk_count; i++) {
+            workers.emplace_back([&, i]() { parseChunk(border[i], border[i + 1], chunks[i], x_offs, y_offs, z_offs, scale); });
+        }
+        for (auto &w : workers) w.join();
+    }
+
+    // merge the chunks in file order
+    std::vector<GroupEvent> events;
+    for (auto &c : chunks) {
+        int base[3] = {(int)vertex.size(), (int)texcoord.size() / 2, (int)normal.size()};
+        for (int pos : c.fix_vertex) c.triangle[pos] += base[0];
+        for (int pos : c.fix_texcoord) c.triangle_texcoord[pos] += base[1];
+        for (int pos : c.fix_normal) c.triangle_normal[pos] += base[2];
+
+        for (auto &e : c.events) events.push_back({e.triangle + (int)triangle.size() / 3, e.material, std::move(e.name)});
+
+        vertex.insert(vertex.end(), c.vertex.begin(), c.vertex.end());
+        texcoord.insert(texcoord.end(), c.texcoord.begin(), c.texcoord.end());
+        normal.insert(normal.end(), c.normal.begin(), c.normal.end());
+        triangle.insert(triangle.end(), c.triangle.begin(), c.triangle.end());
+        triangle_texcoord.insert(triangle_texcoord.end(), c.triangle_texcoord.begin(), c.triangle_texcoord.end());
+        triangle_normal.insert(triangle_normal.end(), c.triangle_normal.begin(), c.triangle_normal.end());
+    }
+
+    // drop triangles that refer to missing elements, kept[i] counts the kept triangles before i
+    int count = triangle.size() / 3, dropped = 0;
+    std::vector<int> kept(count + 1, 0);
+    for (int i = 0; i < count; i++) {
+        bool valid = true;
+        for (int k = i * 3; k < i * 3 + 3; k++) {
+            valid = valid && triangle[k] >= 0 && triangle[k] < (int)vertex.size();
+            valid = valid && triangle_texcoord[k] < (int)texcoord.size() / 2 && triangle_normal[k] < (int)normal.size();
+            valid = valid && triangle_texcoord[k] >= -1 && triangle_normal[k] >= -1;
+        }
+
+        kept[i + 1] = kept[i] + valid;
+        if (!valid) {
+            dropped++;
+            continue;
+        }
+        for (int k = 0; k < 3; k++) {
+            triangle[kept[i] * 3 + k] = triangle[i * 3 + k];
+            triangle_texcoord[kept[i] * 3 + k] = triangle_texcoord[i * 3 + k];
+            triangle_normal[kept[i] * 3 + k] = triangle_normal[i * 3 + k];
+        }
+    }
+    triangle.resize(kept[count] * 3);
+    triangle_texcoord.resize(kept[count] * 3);
+    triangle_normal.resize(kept[count] * 3);
+    if (dropped > 0) std::cerr << "Dropped " << dropped << " triangles with invalid indices in obj: " << path << std::endl;
 
-        ss.clear();
+    // replay the o / g / usemtl lines into runs of triangles
+    std::string name, material;
+    int first = 0;
+    auto closeGroup = [&](int next) {
+        if (next > first) group.push_back({name, material, first, next - first});
+        first = std::max(first, next);
+    };
+    for (auto &e : events) {
+        closeGroup(kept[e.triangle]);
+        if (e.material) material = e.name;
+        else name = e.name;
     }
-    ifs.close();
-}
\ No newline at end of file
+    closeGroup(kept[count]);
+}
@@ -0,0 +1,74 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include "obj.h"
+#include "mesh.h"
+#include "mesh_file.h"
+
+// convert an obj model into a binary mesh file with its bvh, so renders can skip parsing and building
+static void usage(const char *name) {
+    std::cout << "usage: " << name << " <input.obj> <output.rtm> [options]\n"
+              << "  -s, --scale <f>          uniform scale baked into the vertices (default 1)\n"
+              << "  -d, --offset <x> <y> <z> offset baked into the vertices (default 0 0 0)\n"
+              << "  -t, --threads <n>        obj parser and bvh build threads, 0 for all cores (default 1)\n"
+              << "  -b, --builder <name>     bvh builder, sah or lbvh (default sah)\n";
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    float scale = 1, x_offs = 0, y_offs = 0, z_offs = 0;
+    int threads = 1;
+    BVH::Builder builder = BVH::binned_sah;
+    for (int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        if ((arg == "-s" || arg == "--scale") && i + 1 < argc) scale = std::atof(argv[++i]);
+        else if ((arg == "-d" || arg == "--offset") && i + 3 < argc) {
+            x_offs = std::atof(argv[++i]);
+            y_offs = std::atof(argv[++i]);
+            z_offs = std::atof(argv[++i]);
+        }
+        else if ((arg == "-t" || arg == "--threads") && i + 1 < argc) threads = std::atoi(argv[++i]);
+        else if ((arg == "-b" || arg == "--builder") && i + 1 < argc) {
+            std::string name = argv[++i];
+            if (name == "sah") builder = BVH::binned_sah;
+            else if (name == "lbvh") builder = BVH::lbvh;
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+    auto start = std::chrono::steady_clock::now();
+    OBJ obj(argv[1], x_offs, y_offs, z_offs, scale, threads);
+    auto parsed = std::chrono::steady_clock::now();
+    Model model;
+    model.vertex = std::move(obj.vertex);
+    model.index = std::move(obj.triangle);
+    model.builder = builder;
+    model.build_threads = threads;
+    model.build();
+    auto end = std::chrono::steady_clock::now();
+
+    if (!saveModel(model, argv[2])) {
+        std::cerr << "Failed to write mesh file: " << argv[2] << std::endl;
+        return 1;
+    }
+
+    std::cout << model.triangle.size() << " triangles, " << model.bvh.nodes.size() << " bvh nodes, sah cost "
+              << model.bvh.sahCost() << ", " << std::chrono::duration<double, std::milli>(parsed - start).count() << " ms to parse, "
+              << std::chrono::duration<double, std::milli>(end - parsed).count() << " ms to build" << std::endl;
+    return 0;
+}
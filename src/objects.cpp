@@ -1,4 +1,8 @@
 #include "objects.h"
+#include "wavefront.h"
+#include "random.h"
+#include "stats.h"
+#include <bit>
 
 bool Camera::checkUpAndRight() {
     Vector3D n = eye - center; // opposite of view direction
@@ -25,28 +29,67 @@ void Light::setParentScene(std::shared_ptr<Scene> scene) {
     parent_scene = scene;
 }
 
-Vector3D AmbientLight::getColor(const Hit &hit, std::shared_ptr<Object> hit_object, const Vector3D &V) {
-    if (Vector3D::dot(V, std::get<Vector3D>(hit)) > 0) return Vector3D::zero;
-    Vector3D ret = hit_object->mesh_renderer.material->Ka * intensity;
+Vector3D AmbientLight::getColor(const Hit &hit, const Material &material, const Vector3D &V) const {
+    if (Vector3D::dot(V, hit.normal) > 0) return Vector3D::zero;
+    Vector3D ret = material.Ka * intensity;
 
     return ret;
 }
 
-Vector3D PointLight::getColor(const Hit &hit, std::shared_ptr<Object> hit_object, const Vector3D &V) {
+bool AmbientLight::shadowRay(const Hit &hit, const Vector3D &V, Ray &ray, float &t_max) const {
+    ray = Ray(hit.point, hit.normal);
+    t_max = 0;
+    return true;
+}
+
+Vector3D AmbientLight::getLitColor(const Hit &hit, const Material &material, const Vector3D &V) const {
+    return getColor(hit, material, V);
+}
+
+float AmbientLight::importance(const Hit &hit) const {
+    return intensity.x + intensity.y + intensity.z;
+}
+
+Vector3D PointLight::getColor(const Hit &hit, const Material &material, const Vector3D &V) const {
+    Ray detect_ray;
+    float t_max;
+    if (!shadowRay(hit, V, detect_ray, t_max)) return Vector3D::zero;
+
+    // shadow check
+    if (parent_scene->underShadow(detect_ray, t_max)) return Vector3D::zero;
+
+    return getLitColor(hit, material, V);
+}
+
+bool PointLight::shadowRay(const Hit &hit, const Vector3D &V, Ray &ray, float &t_max) const {
     // hit point and normal
-    Point hit_point = std::get<Point>(hit);
-    Vector3D hit_normal = std::get<Vector3D>(hit);
+    Point hit_point = hit.point;
+    Vector3D hit_normal = hit.normal;
 
-    if (Vector3D::dot(V, hit_normal) > 0) return Vector3D::zero;
+    if (Vector3D::dot(V, hit_normal) > 0) return false;
 
     // direction from hit point to light
     Vector3D L = position - hit_point;
-    float t_max = L.magnitude();
-    L.normalize();
+    t_max = L.magnitude();
+    L = L / t_max;
 
-    // shadow check
-    Ray detect_ray(hit_point, L);
-    if (parent_scene->underShadow(detect_ray, t_max)) return Vector3D::zero;
+    // out of range, not worth a shadow ray
+    if (radius > 0 && t_max >= radius) return false;
+
+    // the light is behind the face
+    if (Vector3D::dot(L, hit_normal) <= 0) return false;
+
+    ray = Ray(hit_point, L);
+    return true;
+}
+
+Vector3D PointLight::getLitColor(const Hit &hit, const Material &material, const Vector3D &V) const {
+    Point hit_point = hit.point;
+    Vector3D hit_normal = hit.normal;
+
+    if (Vector3D::dot(V, hit_normal) > 0) return Vector3D::zero;
+
+    Vector3D L = (position - hit_point).normalized();
 
     // calculate cosA, A is the angle of L and n
     float a = Vector3D::dot(L, hit_normal);
@@ -57,13 +100,39 @@ Vector3D PointLight::getColor(const Hit &hit, std::shared_ptr<Object> hit_object
     float b = Vector3D::dot(H, hit_normal) / H.magnitude();
 
     // diffuse and reflect
-    auto material = hit_object->mesh_renderer.material;
-    Vector3D diffuse = material->Kd * intensity * a;
-    Vector3D reflect = material->Ks * intensity * std::pow(b, material->shininess);
+    Vector3D diffuse = material.Kd * intensity * a;
+    Vector3D reflect = material.Ks * intensity * std::pow(b, material.shininess);
 
+    if (radius > 0) return (diffuse + reflect) * attenuation(Point::distance(position, hit_point));
     return diffuse + reflect;
 }
 
+float PointLight::importance(const Hit &hit) const {
+    Vector3D L = position - hit.point;
+    float d = L.magnitude();
+    float cos_val = Vector3D::dot(L, hit.normal) / d;
+    if (cos_val <= 0) return 0;
+
+    // the diffuse term without the material, the specular term is only there when this one is
+    return (intensity.x + intensity.y + intensity.z) * cos_val * attenuation(d);
+}
+
+bool PointLight::bounds(AABB &box) const {
+    if (radius <= 0) return false;
+    box = AABB();
+    box.expand(position - Vector3D(radius, radius, radius));
+    box.expand(position + Vector3D(radius, radius, radius));
+    return true;
+}
+
+float PointLight::attenuation(float d) const {
+    if (radius <= 0) return 1;
+    float x = d / radius;
+    if (x >= 1) return 0;
+    float w = 1 - x * x;
+    return w * w;
+}
+
 void Camera::setCamera(const Point &e, const Point &c, const Vector3D &up, float fovy) {
     this->eye = e;
     this->center = c;
@@ -80,6 +149,10 @@ void Camera::setPerspective(int windowWidth, int windowHeight) {
 }
 
 Ray Camera::getRay(int x, int y, int windowWidth, int windowHeight) {
+    return getRay((float)x, (float)y, windowWidth, windowHeight);
+}
+
+Ray Camera::getRay(float x, float y, int windowWidth, int windowHeight) {
     float w = width / windowWidth;
     float h = height / windowHeight;
     float dx = -(windowWidth - 1) * w / 2 + x * w;
@@ -91,78 +164,360 @@ Ray Camera::getRay(int x, int y, int windowWidth, int windowHeight) {
 // Scene
 void Scene::addObject(std::shared_ptr<Object> object) {
     objects.insert(object);
+    dirty = true;
 }
 
 void Scene::delObject(std::shared_ptr<Object> object) {
     objects.erase(object);
+    dirty = true;
 }
 
 void Scene::addLight(std::shared_ptr<Light> light) {
     assert(std::dynamic_pointer_cast<AmbientLight>(light) == nullptr);
     lights.insert(light);
     light->setParentScene(shared_from_this());
+    dirty = true;
 }
 
 void Scene::delLight(std::shared_ptr<Light> light) {
     assert(std::dynamic_pointer_cast<AmbientLight>(light) == nullptr);
     lights.erase(light);
+    dirty = true;
 }
 
-HitInfo Scene::getIntersection(Ray &ray) {
-    // calculate the nearest hit
-    std::shared_ptr<Object> hit_object = nullptr;
-    Hit hit(Point::none, Vector3D::zero, -1);
-    float dist = -1;
-    for (auto &o : objects) {
-        Hit temp_hit = o->mesh_filter->intersection(ray);
-        float now = std::get<float>(temp_hit);
+void Scene::moved(std::shared_ptr<Object> object) {
+    moved_objects.push_back(object);
+}
+
+void Scene::relit() {
+    relight = true;
+}
 
-        if (fequal(now, -1)) continue;
+void Scene::build() {
+    object_list.assign(objects.begin(), objects.end());
 
-        if (fequal(dist, -1) || now < dist) {
-            hit_object = o;
-            hit = temp_hit;
-            dist = now;
-        }
+    object_bounds.clear();
+    object_bounds.reserve(object_list.size());
+    for (auto &o : object_list) object_bounds.emplace_back(o->mesh_filter->bounds());
+
+    std::vector<Mesh *> meshes;
+    for (auto &o : object_list) meshes.push_back(o->mesh_filter.get());
+    primitives.build(meshes, object_bounds);
+    bvh_entry.clear();
+    for (int i = 0; i < (int)meshes.size(); i++) {
+        if (!PrimitiveGroup::accepts(meshes[i])) bvh_entry.push_back(i);
+    }
+    for (int c = 0; c < (int)primitives.clusters.size(); c++) bvh_entry.push_back(~c);
+    bvh.build(entryBounds());
+
+    compile();
+    dirty = false;
+    moved_objects.clear();
+    changed.clear();
+    frame.color.clear(); // the next incremental frame starts over
+}
+
+void Scene::refit() {
+    for (auto &o : moved_objects) {
+        auto it = std::find(object_list.begin(), object_list.end(), o);
+        if (it == object_list.end()) continue;
+
+        // both the place it left and the place it went to may show up differently now,
+        // padded so rays that just touch the surface still count
+        Vector3D pad(Ray::offset, Ray::offset, Ray::offset);
+        AABB &box = object_bounds[it - object_list.begin()];
+        changed.emplace_back(box.min - pad, box.max + pad);
+        box = o->mesh_filter->bounds();
+        changed.emplace_back(box.min - pad, box.max + pad);
     }
+    moved_objects.clear();
+    bvh.refit(entryBounds());
+}
 
-    return {hit, hit_object};
+std::vector<AABB> Scene::entryBounds() const {
+    std::vector<AABB> boxes;
+    boxes.reserve(bvh_entry.size());
+    for (int i : bvh_entry) boxes.push_back(i >= 0 ? object_bounds[i] : primitives.bounds(~i, object_bounds));
+    return boxes;
 }
 
-bool Scene::underShadow(Ray &ray, float t_max) {
-    Hit detect_hit = getIntersection(ray).first;
-    float t_hit = std::get<float>(detect_hit);
+void Scene::compile() {
+    mesh_list.clear();
+    material_id.clear();
+    material_list.clear();
+    std::vector<const Material *> seen; // objects sharing a material share its id
+    for (auto &o : object_list) {
+        const Material *m = o->mesh_renderer.material.get();
+        auto it = std::find(seen.begin(), seen.end(), m);
+        if (it == seen.end()) {
+            seen.push_back(m);
+            material_list.push_back(*m);
+            it = seen.end() - 1;
+        }
+        mesh_list.push_back(o->mesh_filter.get());
+        material_id.push_back(it - seen.begin());
+    }
+    primitives.update(mesh_list);
 
-    return !fequal(t_hit, -1) && t_hit < t_max;
+    light_list.clear();
+    global_lights.clear();
+    bounded_lights.clear();
+    std::vector<AABB> light_boxes;
+    for (auto &l : lights) {
+        AABB box;
+        if (l->bounds(box)) {
+            bounded_lights.push_back(light_list.size());
+            light_boxes.push_back(box);
+        }
+        else {
+            global_lights.push_back(light_list.size());
+        }
+        light_list.push_back(l.get());
+    }
+    light_bvh.build(light_boxes);
 }
 
-Vector3D Scene::rayTrace(Ray &ray, int depth) {
-    if (depth > Scene::maxdepth) return Vector3D();
+Hit Scene::getIntersection(const Ray &ray) {
+    // render() builds before starting threads, this only happens for single-threaded callers
+    if (dirty) build();
 
-    // calculate the nearest hit
+    // calculate the nearest hit, a hit in a cluster is turned into a Hit at the end
     Hit hit;
-    std::shared_ptr<Object> hit_object;
-    std::tie(hit, hit_object) = getIntersection(ray);
+    int cluster = -1, lane = -1;
+    float t_max = FLOAT_MAX;
+    bvh.traverse(ray, t_max, [&](int e) {
+        int i = bvh_entry[e];
+        if (i < 0) {
+            int k = primitives.intersection(~i, ray, Ray::offset, t_max);
+            if (k >= 0) cluster = ~i, lane = k;
+            return;
+        }
 
-    // no intersection point, return background
-    if (fequal(std::get<float>(hit), -1)) return background;
+        Hit temp_hit = mesh_list[i]->intersection(ray);
+        if (fequal(temp_hit.t, -1) || temp_hit.t >= t_max) return;
+
+        hit = temp_hit;
+        hit.object = i;
+        t_max = temp_hit.t;
+        cluster = -1;
+    });
+
+    if (cluster >= 0) {
+        Point p = ray.start + t_max * ray.dir;
+        hit = Hit{p, primitives.normal(cluster, lane, p), t_max, primitives.clusters[cluster].object[lane]};
+    }
+    return hit;
+}
+
+void Scene::getIntersection(const RayPacket &packet, PacketHit &hit) {
+    if (dirty) build();
+
+    bvh.traverse(packet, hit.t, [&](int e) {
+        int i = bvh_entry[e];
+        if (i < 0) {
+            // lane by lane, each ray still tests the whole cluster at once
+            for (int l = 0; l < packet.count; l++) {
+                Ray ray = packet.get(l);
+                int k = primitives.intersection(~i, ray, Ray::offset, hit.t[l]);
+                if (k < 0) continue;
+
+                hit.normal[l] = primitives.normal(~i, k, ray.start + hit.t[l] * ray.dir);
+                hit.prim[l] = primitives.clusters[~i].object[k];
+            }
+            return;
+        }
+
+        unsigned mask = mesh_list[i]->intersection(packet, hit);
+        for (int l = 0; l < packet.count; l++) {
+            if (mask >> l & 1) hit.prim[l] = i;
+        }
+    });
+}
+
+bool Scene::entryOccluded(int e, const Ray &ray, float t_min, float t_max) {
+    int i = bvh_entry[e];
+    if (i < 0) return primitives.occluded(~i, ray, t_min, t_max);
+    return mesh_list[i]->occluded(ray, t_min, t_max);
+}
+
+bool Scene::entryOccluded(int e, const Ray &ray, float t_min, float t_max, int &part) {
+    int i = bvh_entry[e];
+    if (i >= 0) return mesh_list[i]->occluded(ray, t_min, t_max, part);
+
+    float t = t_max;
+    part = primitives.intersection(~i, ray, t_min, t);
+    return part >= 0;
+}
+
+unsigned Scene::entryOccluded(int e, const RayPacket &packet, float t_min, const float *t_max, unsigned lanes) {
+    int i = bvh_entry[e];
+    if (i >= 0) return mesh_list[i]->occluded(packet, t_min, t_max, lanes);
+
+    unsigned mask = 0;
+    for (int l = 0; l < RayPacket::size; l++) {
+        if ((lanes >> l & 1) && primitives.occluded(~i, packet.get(l), t_min, t_max[l])) mask |= 1u << l;
+    }
+    return mask;
+}
+
+unsigned Scene::entryOccluded(int e, const RayPacket &packet, float t_min, const float *t_max, unsigned lanes, int *part) {
+    int i = bvh_entry[e];
+    if (i >= 0) return mesh_list[i]->occluded(packet, t_min, t_max, lanes, part);
+
+    unsigned mask = 0;
+    for (int l = 0; l < RayPacket::size; l++) {
+        if ((lanes >> l & 1) && entryOccluded(e, packet.get(l), t_min, t_max[l], part[l])) mask |= 1u << l;
+    }
+    return mask;
+}
+
+std::vector<Scene::Occluder> &Scene::lastOccluders() {
+    // shared by every scene the thread renders, and kept across rebuilds of the bvh. a stale occluder only
+    // costs a wasted test, it is always checked against the real geometry
+    thread_local std::vector<Occluder> last;
+    if (last.size() < light_list.size()) last.resize(light_list.size());
+    return last;
+}
+
+bool Scene::occluded(const Occluder &o, const Ray &ray, float t_min, float t_max) {
+    if (o.entry < 0 || o.entry >= (int)bvh_entry.size()) return false;
+
+    int i = bvh_entry[o.entry];
+    if (i < 0) return primitives.occluded(~i, o.part, ray, t_min, t_max);
+    return mesh_list[i]->partOccluded(o.part, ray, t_min, t_max);
+}
+
+bool Scene::occluded(const Ray &ray, float t_min, float t_max, int light) {
+    if (dirty) build();
+    RT_COUNT(shadow_rays, 1);
+
+    if (light < 0 || !occluder_cache) return bvh.occluded(ray, t_max, [&](int e) { return entryOccluded(e, ray, t_min, t_max); });
+
+    Occluder &last = lastOccluders()[light];
+    if (occluded(last, ray, t_min, t_max)) {
+        RT_COUNT(occluder_hits, 1);
+        return true;
+    }
+
+    // a lit ray empties the cache, so the points around it don't test an occluder first either
+    last = Occluder();
+    return bvh.occluded(ray, t_max, [&](int e) {
+        int part;
+        if (!entryOccluded(e, ray, t_min, t_max, part)) return false;
+        last = {e, part};
+        return true;
+    });
+}
+
+unsigned Scene::occluded(const RayPacket &packet, float t_min, const float *t_max, unsigned active, const int *light) {
+    if (dirty) build();
+    RT_COUNT(shadow_rays, std::popcount(active));
+
+    if (!light || !occluder_cache) {
+        return bvh.occluded(packet, t_max, active, [&](int e, unsigned lanes) { return entryOccluded(e, packet, t_min, t_max, lanes); });
+    }
+
+    // the cached occluders lane by lane, each is a single primitive
+    std::vector<Occluder> &last = lastOccluders();
+    unsigned blocked = 0;
+    for (int l = 0; l < RayPacket::size; l++) {
+        if (!(active >> l & 1) || last[light[l]].entry < 0) continue;
+        if (occluded(last[light[l]], packet.get(l), t_min, t_max[l])) blocked |= 1u << l;
+    }
+    RT_COUNT(occluder_hits, std::popcount(blocked));
+    if (blocked == active) return blocked;
+
+    // lit lanes empty the cache of their light, as in the single ray version
+    for (int l = 0; l < RayPacket::size; l++) {
+        if ((active & ~blocked) >> l & 1) last[light[l]] = Occluder();
+    }
+    return blocked | bvh.occluded(packet, t_max, active & ~blocked, [&](int e, unsigned lanes) {
+        int part[RayPacket::size];
+        unsigned mask = entryOccluded(e, packet, t_min, t_max, lanes, part);
+        for (int l = 0; l < RayPacket::size; l++) {
+            if (mask >> l & 1) last[light[l]] = {e, part[l]};
+        }
+        return mask;
+    });
+}
+
+bool Scene::underShadow(const Ray &ray, float t_max, int light) {
+    return occluded(ray, Ray::offset, t_max, light);
+}
 
-    Vector3D color;
+int Scene::selectLights(const Hit &hit, int *light, float *weight) const {
+    // lights that can reach the hit, kept per thread so they don't allocate after the first frames
+    thread_local std::vector<int> candidate;
+    candidate.assign(global_lights.begin(), global_lights.end());
+    light_bvh.query(hit.point, [&](int i) { candidate.push_back(bounded_lights[i]); });
+
+    int k = std::clamp(light_samples, 1, max_light_samples);
+    int n = candidate.size();
+    if (n <= k) {
+        for (int i = 0; i < n; i++) light[i] = candidate[i], weight[i] = 1;
+        return n;
+    }
 
+    thread_local std::vector<float> cdf;
+    cdf.resize(n);
+    float sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += light_list[candidate[i]]->importance(hit);
+        cdf[i] = sum;
+    }
+    if (sum <= 0) return 0;
+
+    // k stratified draws from the importance cdf with a single random offset, seeded by the hit point.
+    // the draws come out in cdf order, so a light drawn twice is merged into one shadow ray
+    uint64_t a = std::bit_cast<uint32_t>(hit.point.x) | (uint64_t)std::bit_cast<uint32_t>(hit.point.y) << 32;
+    Random rng(Random::hash(a, std::bit_cast<uint32_t>(hit.point.z)));
+    float u = rng.uniform();
+    int count = 0;
+    for (int s = 0, j = 0; s < k; s++) {
+        float target = (s + u) / k * sum;
+        while (j + 1 < n && cdf[j] <= target) j++;
+
+        float p = (cdf[j] - (j > 0 ? cdf[j - 1] : 0)) / sum;
+        if (count > 0 && light[count - 1] == candidate[j]) {
+            weight[count - 1] += 1 / (k * p);
+        }
+        else {
+            light[count] = candidate[j];
+            weight[count++] = 1 / (k * p);
+        }
+    }
+
+    return count;
+}
+
+Vector3D Scene::localColor(const Hit &hit, const Vector3D &V) {
     // local color(use blinn-phong model)
-    color = ambient_light->getColor(hit, hit_object, ray.dir);
-    for (auto &l : lights) {
-        color = color + l->getColor(hit, hit_object, ray.dir);
+    const Material &m = material(hit);
+    Vector3D color = ambient_light->getColor(hit, m, V);
+
+    int light[max_light_samples];
+    float weight[max_light_samples];
+    int n = selectLights(hit, light, weight);
+    for (int i = 0; i < n; i++) {
+        // getColor split up, so the shadow ray goes through the occluder cache of its light
+        Ray ray;
+        float t_max;
+        if (!light_list[light[i]]->shadowRay(hit, V, ray, t_max) || underShadow(ray, t_max, light[i])) continue;
+        color = color + weight[i] * light_list[light[i]]->getLitColor(hit, m, V);
     }
 
-    auto hit_material = hit_object->mesh_renderer.material;
-    auto type = hit_material->type;
-    // if the material is rough, return the local color
-    if (type == Material::Type::ROUGH) return color;
+    return color;
+}
+
+int Scene::scatter(const Ray &ray, const Hit &hit, Ray *rays, Vector3D *weights) const {
+    const Material &hit_material = material(hit);
+    auto type = hit_material.type;
+    // if the material is rough, there is no secondary ray
+    if (type == Material::Type::ROUGH) return 0;
 
-    Point hit_point = std::get<Point>(hit);
-    Vector3D hit_normal = std::get<Vector3D>(hit);
-    Vector3D F0 = hit_material->F0;
+    Point hit_point = hit.point;
+    Vector3D hit_normal = hit.normal;
+    Vector3D F0 = hit_material.F0;
     float cos_val = -Vector3D::dot(ray.dir, hit_normal);
     bool back_side = cos_val < 0;
     if (back_side) {
@@ -176,68 +531,425 @@ Vector3D Scene::rayTrace(Ray &ray, int depth) {
     // UE4 version, said to be faster, but slower in test
     // Vector3D F = F0 + (Vector3D(1, 1, 1) - F0) * std::pow(2, (-5.55473 * cos_val - 6.98316) * cos_val);
 
-    // reflected_color
+    // reflected ray
     Vector3D reflect_dir = ray.dir + 2 * cos_val * hit_normal;
-    Ray reflected_ray(hit_point, reflect_dir);
-    color = color + F * rayTrace(reflected_ray, depth + 1);
+    rays[0] = Ray(hit_point, reflect_dir);
+    weights[0] = F;
+
+    // refracted ray
+    if (type != Material::Type::REFRACTIVE) return 1;
 
-    // refracted_color
-    if (type != Material::Type::REFRACTIVE) return color;
-    
-    float n = hit_material->n;
+    float n = hit_material.n;
     float ratio = back_side ? n / Material::n_air : Material::n_air / n;
     float temp = 1 - ratio * ratio * (1 - cos_val * cos_val);
-    if (temp >= 0) {
-        Vector3D refract_dir = ratio * (ray.dir + cos_val * hit_normal) - std::sqrt(temp) * hit_normal;
-        Ray refracted_ray(hit_point, refract_dir);
-        color = color + (Vector3D(1, 1, 1) - F) * rayTrace(refracted_ray, depth + 1);
+    if (temp < 0) return 1; // total internal reflection
+
+    Vector3D refract_dir = ratio * (ray.dir + cos_val * hit_normal) - std::sqrt(temp) * hit_normal;
+    rays[1] = Ray(hit_point, refract_dir);
+    weights[1] = Vector3D(1, 1, 1) - F;
+    return 2;
+}
+
+bool Scene::survive(const Ray &ray, int depth, const Vector3D &throughput, Vector3D &weight) const {
+    Vector3D w = throughput * weight;
+    float contribution = std::max({w.x, w.y, w.z});
+    if (contribution >= min_contribution) return true;
+    if (!roulette || contribution <= 0) return false;
+
+    // seeded by the ray itself, so a render doesn't depend on how tiles were spread over threads
+    uint64_t a = std::bit_cast<uint32_t>(ray.start.x) | (uint64_t)std::bit_cast<uint32_t>(ray.start.y) << 32;
+    uint64_t b = std::bit_cast<uint32_t>(ray.dir.x) | (uint64_t)std::bit_cast<uint32_t>(ray.dir.y) << 32;
+    Random rng(Random::hash(a, b, depth));
+
+    float p = contribution / min_contribution;
+    if (rng.uniform() >= p) return false;
+    weight = weight / p;
+    return true;
+}
+
+Vector3D Scene::shade(const Ray &ray, const Hit &hit, int depth, const Vector3D &local, const Vector3D &throughput) {
+    Vector3D color = local;
+
+    Ray rays[2];
+    Vector3D weights[2];
+    int n = scatter(ray, hit, rays, weights);
+    for (int i = 0; i < n; i++) {
+        if (depth + 1 > max_depth || !survive(rays[i], depth + 1, throughput, weights[i])) continue;
+        if (i == 0) RT_COUNT(reflection_rays, 1);
+        else RT_COUNT(refraction_rays, 1);
+        color = color + weights[i] * rayTrace(rays[i], depth + 1, throughput * weights[i]);
     }
 
     return color;
 }
 
-void Scene::render(unsigned char *pixel, int windowWidth, int windowHeight) {
+Vector3D Scene::rayTrace(const Ray &ray, const Hit &hit) {
+    return hit.missed() ? background : shade(ray, hit, 0, localColor(hit, ray.dir));
+}
+
+Vector3D Scene::rayTrace(const Ray &ray, int depth, const Vector3D &throughput) {
+    if (depth > max_depth) return Vector3D();
+
+    // calculate the nearest hit
+    Hit hit = getIntersection(ray);
+
+    // no intersection point, return background
+    if (hit.missed()) return background;
+
+    return shade(ray, hit, depth, localColor(hit, ray.dir), throughput);
+}
+
+void Scene::rayTrace(const RayPacket &packet, Vector3D *color, Hit *primary) {
+    PacketHit packet_hit(packet);
+    getIntersection(packet, packet_hit);
+
+    Hit hit[RayPacket::size];
+    Vector3D local[RayPacket::size];
+    int light[RayPacket::size][max_light_samples];
+    float weight[RayPacket::size][max_light_samples];
+    int light_count[RayPacket::size] = {};
+    int slots = 0;
+    unsigned hit_mask = 0;
+    for (int l = 0; l < packet.count; l++) {
+        if (!packet_hit.hit(l)) {
+            if (primary) primary[l] = Hit();
+            continue;
+        }
+        hit[l] = packet_hit.get(packet, l);
+        if (primary) primary[l] = hit[l];
+        local[l] = ambient_light->getColor(hit[l], material(hit[l]), Vector3D(packet.dx[l], packet.dy[l], packet.dz[l]));
+        light_count[l] = selectLights(hit[l], light[l], weight[l]);
+        slots = std::max(slots, light_count[l]);
+        hit_mask |= 1u << l;
+    }
+
+    // one shadow packet per light slot, lane l goes to its slot-th selected light
+    for (int slot = 0; slot < slots; slot++) {
+        RayPacket shadow = packet;
+        alignas(32) float t_max[RayPacket::size];
+        int shadow_light[RayPacket::size];
+        unsigned need = 0;
+        for (int l = 0; l < RayPacket::size; l++) {
+            Ray ray;
+            t_max[l] = -1;
+            if (!(hit_mask >> l & 1) || slot >= light_count[l]) continue;
+            shadow_light[l] = light[l][slot];
+            if (light_list[light[l][slot]]->shadowRay(hit[l], Vector3D(packet.dx[l], packet.dy[l], packet.dz[l]), ray, t_max[l])) {
+                shadow.set(l, ray);
+                need |= 1u << l;
+            }
+        }
+
+        unsigned lit = need & ~occluded(shadow, Ray::offset, t_max, need, shadow_light);
+        for (int l = 0; l < RayPacket::size; l++) {
+            if (!(lit >> l & 1)) continue;
+            Vector3D V(packet.dx[l], packet.dy[l], packet.dz[l]);
+            local[l] = local[l] + weight[l][slot] * light_list[light[l][slot]]->getLitColor(hit[l], material(hit[l]), V);
+        }
+    }
+
+    // secondary rays are traced one by one
+    for (int l = 0; l < packet.count; l++) {
+        if (!(hit_mask >> l & 1)) {
+            color[l] = background;
+            continue;
+        }
+        color[l] = shade(packet.get(l), hit[l], 0, local[l]);
+    }
+}
+
+void Scene::prepare(int windowWidth, int windowHeight) {
     camera->setPerspective(windowWidth, windowHeight);
 
+    // materials may have been edited since the last frame, the arrays are cheap to refresh
+    if (dirty) {
+        build();
+        return;
+    }
+    if (!moved_objects.empty()) refit();
+    compile();
+}
+
+void Scene::forEachTile(int windowWidth, int windowHeight, const std::function<void(int, int, int, int)> &func) {
+    int tiles_x = (windowWidth + tile_size - 1) / tile_size;
+    int tiles_y = (windowHeight + tile_size - 1) / tile_size;
+    auto runTile = [&](int tile) {
+        int x0 = tile % tiles_x * tile_size, y0 = tile / tiles_x * tile_size;
+        int x1 = std::min(x0 + tile_size, windowWidth), y1 = std::min(y0 + tile_size, windowHeight);
+#ifdef RT_STATS
+        double start = Stats::now();
+        func(x0, y0, x1, y1);
+        Stats::local().tiles.push_back({x0, y0, x1, y1, start, Stats::now()});
+#else
+        func(x0, y0, x1, y1);
+#endif
+    };
+
 #ifdef MULTI_THREADS
-    std::cout << "enable multi-threads" << std::endl;
-    int w = windowWidth / 2;
-    int h = windowHeight / 2;
-    std::vector<std::thread> threads;
-
-    for (int i = 0; i < 2; i++) {
-        for (int j = 0; j < 2; j++) {
-            std::thread t([&, i, j]() {
-                for (int x = i * w; x < (i + 1) * w; x++) {
-                    for (int y = j * h; y < (j + 1) * h; y++) {
-                        Ray ray = camera->getRay(x, y, windowWidth, windowHeight);
-                        Vector3D color = rayTrace(ray, 0);
-
-                        // // write pixel
-                        int offset = y * windowWidth * 3 + x * 3;
-                        *(pixel + offset) = std::min(1.0f, color.x) * 255;
-                        *(pixel + offset + 1) = std::min(1.0f, color.y) * 255;
-                        *(pixel + offset + 2) = std::min(1.0f, color.z) * 255;
-                    }
-                }
-            });
-            threads.push_back(std::move(t));
+    int wanted = threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+    if (!pool || pool->size() != wanted) {
+        pool = std::make_shared<ThreadPool>(wanted);
+        std::clog << "enable multi-threads: " << wanted << std::endl;
+    }
+    pool->parallelFor(tiles_x * tiles_y, runTile);
+#else
+    for (int tile = 0; tile < tiles_x * tiles_y; tile++) runTile(tile);
+#endif
+}
+
+void Scene::trace(const float *x, const float *y, int count, int windowWidth, int windowHeight, Vector3D *color, Hit *primary) {
+    if (wavefront) {
+        // queues are kept per thread, so they only grow during the first tiles
+        thread_local Wavefront engine;
+        engine.trace(*this, x, y, count, windowWidth, windowHeight, color, primary);
+        return;
+    }
+
+    RT_COUNT(primary_rays, count);
+    if (!packets) {
+        for (int i = 0; i < count; i++) {
+            Ray ray = camera->getRay(x[i], y[i], windowWidth, windowHeight);
+            if (!primary) {
+                color[i] = rayTrace(ray, 0);
+                continue;
+            }
+            primary[i] = getIntersection(ray);
+            color[i] = rayTrace(ray, primary[i]);
         }
+        return;
     }
 
-    for (auto &t : threads) t.join();
-#else
-    for (int x = 0; x < windowWidth; x++) {
-        for (int y = 0; y < windowHeight; y++) {
-            Ray ray = camera->getRay(x, y, windowWidth, windowHeight);
-            Vector3D color = rayTrace(ray, 0);
+    for (int i = 0; i < count; i += RayPacket::size) {
+        RayPacket packet;
+        packet.count = std::min(RayPacket::size, count - i);
+        for (int l = 0; l < RayPacket::size; l++) {
+            // inactive lanes repeat the last ray, so every lane holds valid numbers
+            int k = i + std::min(l, packet.count - 1);
+            packet.set(l, camera->getRay(x[k], y[k], windowWidth, windowHeight));
+        }
+        rayTrace(packet, color + i, primary ? primary + i : nullptr);
+    }
+}
+
+// k-th of n jittered stratified positions in pixel (x, y), spread over a ceil(sqrt(n))^2 grid.
+// n == 1 is the pixel center, so frames without anti-aliasing match the plain render
+static void subpixel(int x, int y, int k, int n, uint64_t seed, float &sx, float &sy) {
+    if (n == 1) {
+        sx = x, sy = y;
+        return;
+    }
+
+    int grid = std::ceil(std::sqrt((float)n));
+    int stratum = k * grid * grid / n;
+    Random rng(Random::hash(seed, k));
+    sx = x - 0.5f + (stratum % grid + rng.uniform()) / grid;
+    sy = y - 0.5f + (stratum / grid + rng.uniform()) / grid;
+}
+
+static void writePixel(unsigned char *pixel, const Vector3D &color) {
+    pixel[0] = std::min(1.0f, color.x) * 255;
+    pixel[1] = std::min(1.0f, color.y) * 255;
+    pixel[2] = std::min(1.0f, color.z) * 255;
+}
+
+Scene::FrameSettings Scene::frameSettings(int windowWidth, int windowHeight) const {
+    FrameSettings f;
+    f.width = windowWidth, f.height = windowHeight;
+    f.eye = camera->eye, f.center = camera->center, f.up = camera->up, f.fovy = camera->fovy;
+    f.background = background;
+    f.max_depth = max_depth, f.light_samples = light_samples;
+    f.aa_min_samples = aa_min_samples, f.aa_max_samples = aa_max_samples, f.aa_threshold = aa_threshold;
+    f.min_contribution = min_contribution, f.roulette = roulette;
+    return f;
+}
+
+bool Scene::affected(const Ray &ray, const Hit &hit) const {
+    auto crosses = [&](const Ray &r, float t_max) {
+        Vector3D inv_dir = r.invDir();
+        for (auto &box : changed) {
+            if (box.intersection(r, inv_dir, t_max) >= 0) return true;
+        }
+        return false;
+    };
+
+    if (changed.empty()) return false;
+    if (crosses(ray, hit.missed() ? FLOAT_MAX : hit.t)) return true;
+    if (hit.missed()) return false;
+
+    Ray rays[2];
+    Vector3D weights[2];
+    if (scatter(ray, hit, rays, weights) > 0) return true;
+
+    // every light that can reach the hit, not only the ones selectLights happens to draw
+    bool blocked = false;
+    auto test = [&](int l) {
+        Ray shadow;
+        float t_max;
+        if (!blocked && light_list[l]->shadowRay(hit, ray.dir, shadow, t_max)) blocked = crosses(shadow, t_max);
+    };
+    for (int l : global_lights) test(l);
+    light_bvh.query(hit.point, [&](int prim) { test(bounded_lights[prim]); });
+    return blocked;
+}
 
-            // write pixel
-            int offset = y * windowWidth * 3 + x * 3;
-            *(pixel + offset) = std::min(1.0f, color.x) * 255;
-            *(pixel + offset + 1) = std::min(1.0f, color.y) * 255;
-            *(pixel + offset + 2) = std::min(1.0f, color.z) * 255;
+void Scene::render(unsigned char *pixel, int windowWidth, int windowHeight) {
+    prepare(windowWidth, windowHeight);
+
+    constexpr int tile_pixels = tile_size * tile_size;
+    int min_samples = std::clamp(aa_min_samples, 1, tile_pixels);
+    int max_samples = std::clamp(aa_max_samples, min_samples, tile_pixels);
+    bool refine = max_samples > min_samples;
+    int pixels = windowWidth * windowHeight;
+    base.resize(pixels);
+    noisy.assign(pixels, 0);
+    std::atomic<int64_t> samples = 0;
+
+    // what the base pass does with each pixel: keep its color, shade its kept hit again, or trace it
+    enum : unsigned char { keep, reshade, retrace };
+    FrameSettings settings = frameSettings(windowWidth, windowHeight);
+    bool reuse = incremental && min_samples == 1 && !frame.color.empty() && frame.settings == settings;
+    auto &todo = frame.todo;
+    todo.assign(pixels, retrace);
+    if (reuse) {
+        forEachTile(windowWidth, windowHeight, [&](int x0, int y0, int x1, int y1) {
+            for (int row = y0; row < y1; row++) {
+                for (int col = x0; col < x1; col++) {
+                    int i = row * windowWidth + col;
+                    Ray ray = camera->getRay(col, row, windowWidth, windowHeight);
+                    todo[i] = affected(ray, frame.hit[i]) ? retrace : relight ? reshade : keep;
+                }
+            }
+        });
+    }
+    changed.clear();
+    relight = false;
+
+    if (incremental) {
+        frame.settings = settings;
+        frame.hit.resize(pixels);
+        frame.color.resize(pixels);
+    }
+    else {
+        frame.hit.clear();
+        frame.color.clear();
+    }
+    Hit *frame_hit = incremental && min_samples == 1 ? frame.hit.data() : nullptr;
+
+    // a pixel's final color, kept for the next frame when incremental
+    auto output = [&](int i, const Vector3D &color) {
+        if (incremental) frame.color[i] = color;
+        writePixel(pixel + i * 3, color);
+    };
+
+    // trace count samples of each listed pixel, at most a tile's worth of rays per trace() call
+    // so the wavefront engine gets full queues, and return their means. with count == 1 the primary
+    // hits go to hit when it isn't null
+    auto tracePixels = [&](const int *px, const int *py, int pixels, int count, Vector3D *mean, Hit *hit) {
+        float x[tile_pixels], y[tile_pixels];
+        Vector3D color[tile_pixels];
+        int per_call = tile_pixels / count;
+        for (int first = 0; first < pixels; first += per_call) {
+            int n = std::min(per_call, pixels - first);
+            for (int i = 0; i < n; i++) {
+                for (int k = 0; k < count; k++) {
+                    int p = first + i;
+                    subpixel(px[p], py[p], k, count, (uint64_t)py[p] * windowWidth + px[p], x[i * count + k], y[i * count + k]);
+                }
+            }
+            trace(x, y, n * count, windowWidth, windowHeight, color, hit ? hit + first : nullptr);
+
+            for (int i = 0; i < n; i++) {
+                Vector3D sum = color[i * count];
+                for (int k = 1; k < count; k++) sum = sum + color[i * count + k];
+                mean[first + i] = count == 1 ? sum : sum / count;
+
+                // spread of the base samples themselves, for min_samples > 1
+                if (!refine || count == 1) continue;
+                float spread = 0;
+                for (int k = 0; k < count; k++) {
+                    Vector3D d = color[i * count + k] - mean[first + i];
+                    spread = std::max({spread, std::abs(d.x), std::abs(d.y), std::abs(d.z)});
+                }
+                if (spread > aa_threshold) noisy[py[first + i] * windowWidth + px[first + i]] = 1;
+            }
+        }
+        samples += (int64_t)pixels * count;
+    };
+
+    // base pass, every pixel to trace gets min_samples
+    forEachTile(windowWidth, windowHeight, [&](int x0, int y0, int x1, int y1) {
+        int px[tile_pixels], py[tile_pixels];
+        Vector3D color[tile_pixels];
+        Hit hit[tile_pixels];
+        int count = 0;
+        for (int row = y0; row < y1; row++) {
+            for (int col = x0; col < x1; col++) {
+                int i = row * windowWidth + col;
+                if (todo[i] == reshade) {
+                    base[i] = rayTrace(camera->getRay(col, row, windowWidth, windowHeight), frame.hit[i]);
+                }
+                else if (todo[i] == retrace) {
+                    px[count] = col;
+                    py[count++] = row;
+                }
+            }
+        }
+        tracePixels(px, py, count, min_samples, color, frame_hit ? hit : nullptr);
+
+        for (int i = 0; i < count; i++) {
+            int p = py[i] * windowWidth + px[i];
+            base[p] = color[i];
+            if (frame_hit) frame_hit[p] = hit[i];
+        }
+        if (refine) return;
+        for (int row = y0; row < y1; row++) {
+            for (int col = x0; col < x1; col++) {
+                int i = row * windowWidth + col;
+                output(i, todo[i] == keep ? frame.color[i] : base[i]);
+            }
         }
+    });
+
+    // refine pass, pixels that differ from a neighbor or whose base samples disagree get max_samples.
+    // a kept pixel only needs a new look when a neighbor changed, otherwise it keeps its last color
+    if (refine) {
+        forEachTile(windowWidth, windowHeight, [&](int x0, int y0, int x1, int y1) {
+            int px[tile_pixels], py[tile_pixels];
+            Vector3D color[tile_pixels];
+            int count = 0;
+            for (int row = y0; row < y1; row++) {
+                for (int col = x0; col < x1; col++) {
+                    int i = row * windowWidth + col;
+                    bool edge = noisy[i], near_change = todo[i] != keep;
+                    for (int dy = -1; dy <= 1; dy++) {
+                        for (int dx = -1; dx <= 1; dx++) {
+                            int nx = col + dx, ny = row + dy;
+                            if (nx < 0 || ny < 0 || nx >= windowWidth || ny >= windowHeight) continue;
+                            int n = ny * windowWidth + nx;
+                            near_change = near_change || todo[n] != keep;
+                            if (edge) continue;
+                            Vector3D d = base[n] - base[i];
+                            edge = std::max({std::abs(d.x), std::abs(d.y), std::abs(d.z)}) > aa_threshold;
+                        }
+                    }
+
+                    if (!near_change) {
+                        output(i, frame.color[i]);
+                    }
+                    else if (edge) {
+                        px[count] = col;
+                        py[count++] = row;
+                    }
+                    else {
+                        output(i, base[i]);
+                    }
+                }
+            }
+            tracePixels(px, py, count, max_samples, color, nullptr);
+
+            for (int i = 0; i < count; i++) output(py[i] * windowWidth + px[i], color[i]);
+        });
     }
-#endif
-}
\ No newline at end of file
+
+    last_samples = samples;
+}
@@ -0,0 +1,112 @@
+#include "packet.h"
+
+void RayPacket::set(int lane, const Ray &ray) {
+    ox[lane] = ray.start.x, oy[lane] = ray.start.y, oz[lane] = ray.start.z;
+    dx[lane] = ray.dir.x, dy[lane] = ray.dir.y, dz[lane] = ray.dir.z;
+
+    Vector3D inv_dir = ray.invDir();
+    ix[lane] = inv_dir.x, iy[lane] = inv_dir.y, iz[lane] = inv_dir.z;
+}
+
+Ray RayPacket::get(int lane) const {
+    Ray ray;
+    ray.start = Point(ox[lane], oy[lane], oz[lane]);
+    ray.dir = Vector3D(dx[lane], dy[lane], dz[lane]);
+    return ray;
+}
+
+PacketHit::PacketHit(const RayPacket &packet) {
+    for (int l = 0; l < RayPacket::size; l++) {
+        t[l] = l < packet.count ? FLOAT_MAX : -1;
+        prim[l] = -1;
+    }
+}
+
+Hit PacketHit::get(const RayPacket &packet, int lane) const {
+    if (!hit(lane)) return Hit();
+
+    Point p(packet.ox[lane] + t[lane] * packet.dx[lane],
+            packet.oy[lane] + t[lane] * packet.dy[lane],
+            packet.oz[lane] + t[lane] * packet.dz[lane]);
+    return Hit{p, normal[lane], t[lane], prim[lane]};
+}
+
+// same math as Sphere::intersection, see mesh.cpp
+PACKET_KERNEL void sphereDistance(const Point &center, float radius, const RayPacket &packet, float t_min, float *t) {
+    for (int l = 0; l < RayPacket::size; l++) {
+        float px = packet.ox[l] - center.x, py = packet.oy[l] - center.y, pz = packet.oz[l] - center.z;
+        float B = 2 * (packet.dx[l] * px + packet.dy[l] * py + packet.dz[l] * pz);
+        float C = px * px + py * py + pz * pz - radius * radius;
+        float delta = B * B - 4 * C;
+
+        float root = std::sqrt(std::max(delta, 0.0f));
+        float t1 = (-B + root) / 2.0f;
+        float t2 = (-B - root) / 2.0f;
+        float near = t2 >= t_min ? t2 : t1;
+        t[l] = delta >= 0 && near >= t_min ? near : FLOAT_MAX;
+    }
+}
+
+// same math as Plane::occluded, see mesh.cpp
+PACKET_KERNEL void planeDistance(const Point &lb, const Vector3D &right, const Vector3D &up, const RayPacket &packet, float t_min, float *t) {
+    // copies, t could alias the arguments as far as the compiler knows and the loop would stay scalar
+    Vector3D n = Vector3D::cross(right, up), ru = right, uu = up;
+    Point o = lb;
+    float up_len2 = up.sqrMagnitude();
+    float right_len2 = right.sqrMagnitude();
+
+    for (int l = 0; l < RayPacket::size; l++) {
+        float divisor = packet.dx[l] * n.x + packet.dy[l] * n.y + packet.dz[l] * n.z;
+        float sx = packet.ox[l] - o.x, sy = packet.oy[l] - o.y, sz = packet.oz[l] - o.z;
+        float dist = -(sx * n.x + sy * n.y + sz * n.z) / divisor;
+
+        float vx = sx + dist * packet.dx[l], vy = sy + dist * packet.dy[l], vz = sz + dist * packet.dz[l];
+        float u = vx * uu.x + vy * uu.y + vz * uu.z;
+        float r = vx * ru.x + vy * ru.y + vz * ru.z;
+
+        bool inside = u >= 0 && u <= up_len2 && r >= 0 && r <= right_len2;
+        t[l] = !fequal(divisor, 0) && dist >= t_min && inside ? dist : FLOAT_MAX;
+    }
+}
+
+// same math as triangleIntersection in mesh.cpp
+PACKET_KERNEL void triangleDistance(const Triangle &tri, const RayPacket &packet, float t_min, float *t) {
+    for (int l = 0; l < RayPacket::size; l++) {
+        // p = dir x e2
+        float px = packet.dy[l] * tri.e2.z - packet.dz[l] * tri.e2.y;
+        float py = packet.dz[l] * tri.e2.x - packet.dx[l] * tri.e2.z;
+        float pz = packet.dx[l] * tri.e2.y - packet.dy[l] * tri.e2.x;
+        float det = tri.e1.x * px + tri.e1.y * py + tri.e1.z * pz;
+        float inv_det = 1 / det;
+
+        float sx = packet.ox[l] - tri.v0.x, sy = packet.oy[l] - tri.v0.y, sz = packet.oz[l] - tri.v0.z;
+        float u = (sx * px + sy * py + sz * pz) * inv_det;
+
+        // q = s x e1
+        float qx = sy * tri.e1.z - sz * tri.e1.y;
+        float qy = sz * tri.e1.x - sx * tri.e1.z;
+        float qz = sx * tri.e1.y - sy * tri.e1.x;
+        float v = (packet.dx[l] * qx + packet.dy[l] * qy + packet.dz[l] * qz) * inv_det;
+        float dist = (tri.e2.x * qx + tri.e2.y * qy + tri.e2.z * qz) * inv_det;
+
+        bool inside = !fequal(det, 0) && u >= 0 && u <= 1 && v >= 0 && u + v <= 1 && dist >= t_min;
+        t[l] = inside ? dist : FLOAT_MAX;
+    }
+}
+
+PACKET_KERNEL unsigned boxIntersection(const AABB &box, const RayPacket &packet, const float *t_max, float *t_enter) {
+    unsigned mask = 0;
+    for (int l = 0; l < RayPacket::size; l++) {
+        float tx1 = (box.min.x - packet.ox[l]) * packet.ix[l], tx2 = (box.max.x - packet.ox[l]) * packet.ix[l];
+        float ty1 = (box.min.y - packet.oy[l]) * packet.iy[l], ty2 = (box.max.y - packet.oy[l]) * packet.iy[l];
+        float tz1 = (box.min.z - packet.oz[l]) * packet.iz[l], tz2 = (box.max.z - packet.oz[l]) * packet.iz[l];
+
+        float enter = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::max(std::min(tz1, tz2), 0.0f));
+        float exit = std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::min(std::max(tz1, tz2), t_max[l]));
+
+        t_enter[l] = enter;
+        mask |= (enter <= exit) << l;
+    }
+
+    return mask;
+}
@@ -0,0 +1,175 @@
+#include <typeinfo>
+#include "primitives.h"
+#include "packet.h"
+#include "bvh.h"
+#include "stats.h"
+
+// same math as Sphere::intersection, see mesh.cpp, one ray against every lane: the nearer root >= t_min or FLOAT_MAX
+// the ray is copied to locals first, t could alias it as far as the compiler knows and the loop would stay scalar
+PACKET_KERNEL static void sphereDistances(const PrimitiveGroup::Spheres &s, const Ray &ray, float t_min, float *t) {
+    float ox = ray.start.x, oy = ray.start.y, oz = ray.start.z;
+    float dx = ray.dir.x, dy = ray.dir.y, dz = ray.dir.z;
+    for (int k = 0; k < PrimitiveGroup::width; k++) {
+        float px = ox - s.cx[k], py = oy - s.cy[k], pz = oz - s.cz[k];
+        float B = 2 * (dx * px + dy * py + dz * pz);
+        float C = px * px + py * py + pz * pz - s.r2[k];
+        float delta = B * B - 4 * C;
+
+        float root = std::sqrt(std::max(delta, 0.0f));
+        float t1 = (-B + root) / 2.0f;
+        float t2 = (-B - root) / 2.0f;
+        float near = t2 >= t_min ? t2 : t1;
+        t[k] = delta >= 0 && near >= t_min ? near : FLOAT_MAX;
+    }
+}
+
+// same math as Plane::intersection, with the edges compared by their squared lengths
+PACKET_KERNEL static void quadDistances(const PrimitiveGroup::Quads &q, const Ray &ray, float t_min, float *t) {
+    float ox = ray.start.x, oy = ray.start.y, oz = ray.start.z;
+    float dx = ray.dir.x, dy = ray.dir.y, dz = ray.dir.z;
+    for (int k = 0; k < PrimitiveGroup::width; k++) {
+        float divisor = dx * q.nx[k] + dy * q.ny[k] + dz * q.nz[k];
+        float sx = ox - q.ox[k], sy = oy - q.oy[k], sz = oz - q.oz[k];
+        float dist = -(sx * q.nx[k] + sy * q.ny[k] + sz * q.nz[k]) / divisor;
+
+        float vx = sx + dist * dx, vy = sy + dist * dy, vz = sz + dist * dz;
+        float u = vx * q.ux[k] + vy * q.uy[k] + vz * q.uz[k];
+        float r = vx * q.rx[k] + vy * q.ry[k] + vz * q.rz[k];
+
+        bool inside = u >= 0 && u <= q.up_len2[k] && r >= 0 && r <= q.right_len2[k];
+        t[k] = !fequal(divisor, 0) && dist >= t_min && inside ? dist : FLOAT_MAX;
+    }
+}
+
+bool PrimitiveGroup::accepts(const Mesh *mesh) {
+    return typeid(*mesh) == typeid(Sphere) || typeid(*mesh) == typeid(Plane);
+}
+
+void PrimitiveGroup::build(const std::vector<Mesh *> &meshes, const std::vector<AABB> &bounds) {
+    clusters.clear();
+    spheres.clear();
+    quads.clear();
+
+    for (bool quad : {false, true}) {
+        std::vector<int> objects;
+        std::vector<AABB> boxes;
+        for (int i = 0; i < (int)meshes.size(); i++) {
+            if (accepts(meshes[i]) && (typeid(*meshes[i]) == typeid(Plane)) == quad) {
+                objects.push_back(i);
+                boxes.push_back(bounds[i]);
+            }
+        }
+        if (objects.empty()) continue;
+
+        // subtrees of a bvh over them with at most width primitives become clusters, a subtree covers a
+        // contiguous range of its index
+        BVH tree;
+        tree.build(boxes);
+        std::vector<std::pair<int, int>> range(tree.nodes.size());
+        for (int i = (int)tree.nodes.size() - 1; i >= 0; i--) {
+            const BVH::Node &n = tree.nodes[i];
+            if (n.count > 0) range[i] = {n.first, n.count};
+            else range[i] = {range[n.first].first, range[n.first].second + range[n.first + 1].second};
+        }
+
+        std::vector<int> stack = {0};
+        while (!stack.empty()) {
+            int node = stack.back();
+            stack.pop_back();
+            auto [first, count] = range[node];
+            if (count > width) {
+                stack.push_back(tree.nodes[node].first + 1);
+                stack.push_back(tree.nodes[node].first);
+                continue;
+            }
+
+            Cluster c{quad, count, (int)(quad ? quads.size() : spheres.size()), {}};
+            for (int k = 0; k < width; k++) c.object[k] = k < count ? objects[tree.index[first + k]] : -1;
+            clusters.push_back(c);
+            if (quad) quads.emplace_back();
+            else spheres.emplace_back();
+        }
+    }
+
+    update(meshes);
+}
+
+void PrimitiveGroup::update(const std::vector<Mesh *> &meshes) {
+    for (auto &c : clusters) {
+        for (int k = 0; k < c.count; k++) {
+            if (c.quads) {
+                auto plane = static_cast<const Plane *>(meshes[c.object[k]]);
+                Quads &q = quads[c.data];
+                Vector3D n = Vector3D::cross(plane->right, plane->up).normalized();
+                q.ox[k] = plane->lb.x, q.oy[k] = plane->lb.y, q.oz[k] = plane->lb.z;
+                q.nx[k] = n.x, q.ny[k] = n.y, q.nz[k] = n.z;
+                q.rx[k] = plane->right.x, q.ry[k] = plane->right.y, q.rz[k] = plane->right.z;
+                q.ux[k] = plane->up.x, q.uy[k] = plane->up.y, q.uz[k] = plane->up.z;
+                q.right_len2[k] = plane->right.sqrMagnitude();
+                q.up_len2[k] = plane->up.sqrMagnitude();
+            }
+            else {
+                auto sphere = static_cast<const Sphere *>(meshes[c.object[k]]);
+                Spheres &s = spheres[c.data];
+                s.cx[k] = sphere->center.x, s.cy[k] = sphere->center.y, s.cz[k] = sphere->center.z;
+                s.r2[k] = sphere->radius * sphere->radius;
+            }
+        }
+    }
+}
+
+AABB PrimitiveGroup::bounds(int cluster, const std::vector<AABB> &object_bounds) const {
+    AABB box;
+    const Cluster &c = clusters[cluster];
+    for (int k = 0; k < c.count; k++) box.expand(object_bounds[c.object[k]]);
+    return box;
+}
+
+void PrimitiveGroup::distances(const Cluster &c, const Ray &ray, float t_min, float *t) const {
+    if (c.quads) {
+        RT_COUNT(plane_tests, c.count);
+        quadDistances(quads[c.data], ray, t_min, t);
+    }
+    else {
+        RT_COUNT(sphere_tests, c.count);
+        sphereDistances(spheres[c.data], ray, t_min, t);
+    }
+}
+
+int PrimitiveGroup::intersection(int cluster, const Ray &ray, float t_min, float &t_max) const {
+    const Cluster &c = clusters[cluster];
+    alignas(32) float t[width];
+    distances(c, ray, t_min, t);
+
+    int lane = -1;
+    for (int k = 0; k < c.count; k++) {
+        if (t[k] >= t_max) continue;
+        t_max = t[k];
+        lane = k;
+    }
+    return lane;
+}
+
+bool PrimitiveGroup::occluded(int cluster, const Ray &ray, float t_min, float t_max) const {
+    float t = t_max;
+    return intersection(cluster, ray, t_min, t) >= 0;
+}
+
+bool PrimitiveGroup::occluded(int cluster, int lane, const Ray &ray, float t_min, float t_max) const {
+    const Cluster &c = clusters[cluster];
+    if (lane >= c.count) return false;
+
+    alignas(32) float t[width];
+    distances(c, ray, t_min, t);
+    return t[lane] < t_max;
+}
+
+Vector3D PrimitiveGroup::normal(int cluster, int lane, const Point &p) const {
+    const Cluster &c = clusters[cluster];
+    if (c.quads) {
+        const Quads &q = quads[c.data];
+        return Vector3D(q.nx[lane], q.ny[lane], q.nz[lane]);
+    }
+    const Spheres &s = spheres[c.data];
+    return (p - Point(s.cx[lane], s.cy[lane], s.cz[lane])).normalized();
+}
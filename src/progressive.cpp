@@ -0,0 +1,130 @@
+#include "progressive.h"
+
+static float luminance(const Vector3D &c) {
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
+ProgressiveRenderer::ProgressiveRenderer(std::shared_ptr<Scene> s, int w, int h) : scene(s), width(w), height(h) {
+    reset();
+}
+
+void ProgressiveRenderer::reset() {
+    sum.assign(width * height, Vector3D::zero);
+    sum_sqr.assign(width * height, 0);
+    samples.assign(width * height, 0);
+    preview.assign(width * height, Vector3D::zero);
+    passes = 0;
+    converged = 0;
+    start = std::chrono::steady_clock::now();
+}
+
+bool ProgressiveRenderer::done() const {
+    int preview_count = std::size(preview_strides);
+    if (passes < preview_count) return false;
+    if (converged == width * height || passes - preview_count >= max_samples) return true;
+
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return time_budget > 0 && elapsed >= time_budget;
+}
+
+bool ProgressiveRenderer::pass() {
+    if (done()) return false;
+    if (passes == 0) start = std::chrono::steady_clock::now();
+
+    scene->prepare(width, height);
+    if (passes < (int)std::size(preview_strides)) previewPass(preview_strides[passes]);
+    else samplePass();
+    passes++;
+
+    return true;
+}
+
+void ProgressiveRenderer::run(const std::function<void()> &on_pass) {
+    while (pass()) {
+        if (on_pass) on_pass();
+    }
+}
+
+// one ray through the center of every stride x stride block, filling the whole block
+void ProgressiveRenderer::previewPass(int stride) {
+    std::vector<float> x, y;
+    for (int by = 0; by < height; by += stride) {
+        for (int bx = 0; bx < width; bx += stride) {
+            x.push_back(std::min(bx + stride / 2, width - 1));
+            y.push_back(std::min(by + stride / 2, height - 1));
+        }
+    }
+
+    std::vector<Vector3D> color(x.size());
+    int blocks_x = (width + stride - 1) / stride;
+    int rows = (height + stride - 1) / stride;
+    scene->forEachTile(blocks_x, rows, [&](int x0, int y0, int x1, int y1) {
+        for (int row = y0; row < y1; row++) {
+            int first = row * blocks_x + x0;
+            scene->trace(&x[first], &y[first], x1 - x0, width, height, &color[first]);
+        }
+    });
+
+    for (int i = 0; i < width * height; i++) {
+        int block = (i / width / stride) * blocks_x + (i % width) / stride;
+        preview[i] = color[block];
+    }
+}
+
+// one jittered sample for every pixel that hasn't converged
+void ProgressiveRenderer::samplePass() {
+    std::atomic<int> newly_converged = 0;
+    scene->forEachTile(width, height, [&](int x0, int y0, int x1, int y1) {
+        constexpr int tile_pixels = Scene::tile_size * Scene::tile_size;
+        float x[tile_pixels], y[tile_pixels];
+        int pixel[tile_pixels];
+        Vector3D color[tile_pixels];
+        int done_here = 0;
+
+        // the whole tile in one call, so the wavefront engine gets full queues
+        int count = 0;
+        for (int row = y0; row < y1; row++) {
+            for (int col = x0; col < x1; col++) {
+                int i = row * width + col;
+                if (samples[i] < 0) continue; // converged
+
+                Random rng(Random::hash(i, samples[i]));
+                x[count] = col + rng.uniform() - 0.5f;
+                y[count] = row + rng.uniform() - 0.5f;
+                pixel[count++] = i;
+            }
+        }
+        scene->trace(x, y, count, width, height, color);
+
+        for (int k = 0; k < count; k++) {
+            int i = pixel[k];
+            float l = luminance(color[k]);
+            sum[i] = sum[i] + color[k];
+            sum_sqr[i] += l * l;
+            int n = ++samples[i];
+
+            // standard error of the mean luminance
+            if (n < min_samples) continue;
+            float mean = luminance(sum[i]) / n;
+            float variance = std::max(0.0f, sum_sqr[i] / n - mean * mean) / std::max(n - 1, 1);
+            if (variance < error_threshold * error_threshold) {
+                samples[i] = -n; // negative marks converged, the count is kept for resolve
+                done_here++;
+            }
+        }
+
+        newly_converged += done_here;
+    });
+
+    converged += newly_converged;
+}
+
+void ProgressiveRenderer::resolve(unsigned char *pixel) const {
+    for (int i = 0; i < width * height; i++) {
+        int n = std::abs(samples[i]);
+        Vector3D color = n > 0 ? sum[i] / n : preview[i];
+        pixel[i * 3] = std::min(1.0f, color.x) * 255;
+        pixel[i * 3 + 1] = std::min(1.0f, color.y) * 255;
+        pixel[i * 3 + 2] = std::min(1.0f, color.z) * 255;
+    }
+}
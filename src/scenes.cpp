@@ -0,0 +1,276 @@
+#include "scenes.h"
+
+std::shared_ptr<Scene> createDemoScene(const std::string &model_path) {
+    auto light1 = std::make_shared<PointLight>(Vector3D(1, 1, 1) * 0.55, Point(0, 0, 5));
+    auto light2 = std::make_shared<PointLight>(Vector3D(0.9, 0.9, 0.9) * 0.55, Point(4, 4, 4));
+
+    auto sphere1 = std::make_shared<Object>();
+    sphere1->mesh_filter = std::make_shared<Sphere>(Point(-2, -2, 1.5), 1.5);
+    sphere1->mesh_renderer.material = std::make_shared<Material>(Vector3D(0, 1, 0), 0.8, 0.2, 32, 0);
+
+    auto sphere2 = std::make_shared<Object>();
+    sphere2->mesh_filter = std::make_shared<Sphere>(Point(-3, 2, 1.8), 1.8);
+    sphere2->mesh_renderer.material = std::make_shared<Material>(Vector3D(0.86, 0.86, 0.86), 0.4, 0.8, 128, 1, Vector3D(0.65, 0.65, 0.65));
+
+    auto sphere3 = std::make_shared<Object>();
+    sphere3->mesh_filter = std::make_shared<Sphere>(Point(0.5, -2.5, 0.7), 0.7);
+    sphere3->mesh_renderer.material = std::make_shared<Material>(Vector3D(1, 0, 0), 0.6, 0.7, 128, 0);
+
+    auto sphere4 = std::make_shared<Object>();
+    sphere4->mesh_filter = std::make_shared<Sphere>(Point(1.5, -0.1, 0.75), 0.75);
+    sphere4->mesh_renderer.material = std::make_shared<Material>(Vector3D(1, 1, 1), 0.35, 0.8, 128, 0, Vector3D(0.02, 0.02, 0.02), 1.015);
+
+    std::vector<std::shared_ptr<Object>> plane(6);
+    for (auto &p : plane) p = std::make_shared<Object>();
+    plane[0]->mesh_filter = std::make_shared<Plane>(Point(-10, -10, 0), Vector3D(20, 0, 0), Vector3D(0, 20, 0));
+    plane[0]->mesh_renderer.material = std::make_shared<Material>(Vector3D(0.8, 0.8, 0.8), 0.7, 0.5, 32, 0, Vector3D(0.02, 0.02, 0.02));
+
+    plane[1]->mesh_filter = std::make_shared<Plane>(Point(-10, -10, 6), Vector3D(0, 20, 0), Vector3D(20, 0, 0));
+    plane[1]->mesh_renderer.material = std::make_shared<Material>(Vector3D(1, 1, 1), 1, 0.1, 1, 0);
+
+    plane[2]->mesh_filter = std::make_shared<Plane>(Point(-10, -10, 0), Vector3D(0, 20, 0), Vector3D(0, 0, 6));
+    plane[2]->mesh_renderer.material = std::make_shared<Material>(Vector3D(0.5, 0.5, 0.79), 0.8, 0.3, 32, 0);
+
+    plane[3]->mesh_filter = std::make_shared<Plane>(Point(10, -10, 0), Vector3D(-20, 0, 0), Vector3D(0, 0, 6));
+    plane[3]->mesh_renderer.material = std::make_shared<Material>(Vector3D(0.8, 0.6, 0.8), 0.8, 0.3, 32, 0);
+
+    plane[4]->mesh_filter = std::make_shared<Plane>(Point(-10, 10, 0), Vector3D(20, 0, 0), Vector3D(0, 0, 6));
+    plane[4]->mesh_renderer.material = std::make_shared<Material>(Vector3D(0.8, 0.6, 0.8), 0.8, 0.3, 32, 0);
+    
+    plane[5]->mesh_filter = std::make_shared<Plane>(Point(10, -10, 0), Vector3D(0, 0, 6), Vector3D(0, 20, 0));
+    plane[5]->mesh_renderer.material = std::make_shared<Material>(Vector3D(0.5, 0.5, 0.79), 0.8, 0.3, 32, 0);
+
+    auto water = std::make_shared<Object>();
+    water->mesh_filter = std::make_shared<Plane>(Point(-10, -10, 0.4), Vector3D(20, 0, 0), Vector3D(0, 20, 0));
+    water->mesh_renderer.material = std::make_shared<Material>(Vector3D(0.68, 0.87, 0.89), 0.4, 0.5, 32, 0, Vector3D(0.02, 0.02, 0.02), 1.33);
+
+    auto wall = std::make_shared<Object>();
+    wall->mesh_filter = std::make_shared<Plane>(Point(-5, -10, 0), Vector3D(0, 20, 0), Vector3D(0, 0, 20));
+    wall->mesh_renderer.material = std::make_shared<Material>(Vector3D(1, 1, 1), 0.4, 0.5, 32, 0, Vector3D(0.02, 0.02, 0.02), 1);
+
+    // a .rtm file from objconv is used as is, it must be converted with -d 1 2 0 -s 1.75
+    std::shared_ptr<Model> mesh1 = model_path.ends_with(".rtm") ? loadModel(model_path) : nullptr;
+    if (!mesh1) mesh1 = std::make_shared<Model>(OBJ(model_path, 1, 2, 0, 1.75));
+    auto model1 = std::make_shared<Object>();
+    model1->mesh_filter = mesh1;
+    model1->mesh_renderer.material = std::make_shared<Material>(Vector3D(0.80, 0.69, 0.49), 0.8, 0.5, 64, 0);
+
+    auto model2 = std::make_shared<Object>();
+    auto m = std::make_shared<Model>();
+    Point p1(0.39, -2, 1.1);
+    Point p2(1.1, -2, 0);
+    Point p3(0, -1.25, 0);
+    Point p4(0, -2.75, 0);
+    Face f1(3); f1.vertex.emplace_back(p1); f1.vertex.emplace_back(p2); f1.vertex.emplace_back(p3);
+    Face f2(3); f2.vertex.emplace_back(p1); f2.vertex.emplace_back(p3); f2.vertex.emplace_back(p4);
+    Face f3(3); f3.vertex.emplace_back(p1); f3.vertex.emplace_back(p4); f3.vertex.emplace_back(p2);
+    Face f4(3); f4.vertex.emplace_back(p2); f4.vertex.emplace_back(p4); f4.vertex.emplace_back(p3);
+    m->addFace(f1);
+    m->addFace(f2);
+    m->addFace(f3);
+    m->addFace(f4);
+    m->build();
+    model2->mesh_filter = m;
+    model2->mesh_renderer.material = std::make_shared<Material>(Vector3D(1, 1, 0), 0.7, 0.9, 128, 0.8, Vector3D(0.85, 0.83, 0.79));
+
+    auto s = std::make_shared<Scene>();
+    // lights
+    s->ambient_light = std::make_shared<AmbientLight>(Vector3D(0.1, 0.1, 0.1));
+    s->addLight(light1);
+    s->addLight(light2);
+
+    // objects
+    s->addObject(sphere1);
+    s->addObject(sphere2);
+    s->addObject(sphere3);
+    s->addObject(sphere4);
+    s->addObject(plane[0]);
+    s->addObject(plane[1]);
+    s->addObject(plane[2]);
+    s->addObject(plane[3]);
+    s->addObject(plane[4]);
+    s->addObject(plane[5]);
+    // s->addObject(water);
+    // s->addObject(wall);
+    
+    s->addObject(model1);
+    // s->addObject(model2);
+
+    // camera
+    s->camera = std::make_shared<Camera>();
+    s->camera->setCamera(Point(5, 0, 1), Point(0, 0, 0.5), Vector3D::back, 60);
+
+    // background
+    // s->background = Vector3D(0.53, 0.81, 0.92);
+    s->background = Vector3D(0, 0, 0);
+
+    return s;
+}
+
+// floor, two lights (unless the scene brings its own) and a camera looking at the origin from (x, 0, z),
+// shared by the generated scenes
+static std::shared_ptr<Scene> createRoom(float x, float z, bool lights = true) {
+    auto s = std::make_shared<Scene>();
+    s->ambient_light = std::make_shared<AmbientLight>(Vector3D(0.1, 0.1, 0.1));
+    if (lights) {
+        s->addLight(std::make_shared<PointLight>(Vector3D(1, 1, 1) * 0.55, Point(0, 0, 8)));
+        s->addLight(std::make_shared<PointLight>(Vector3D(0.9, 0.9, 0.9) * 0.55, Point(6, 6, 6)));
+    }
+
+    auto floor = std::make_shared<Object>();
+    floor->mesh_filter = std::make_shared<Plane>(Point(-20, -20, 0), Vector3D(40, 0, 0), Vector3D(0, 40, 0));
+    floor->mesh_renderer.material = std::make_shared<Material>(Vector3D(0.8, 0.8, 0.8), 0.7, 0.5, 32, 0, Vector3D(0.02, 0.02, 0.02));
+    s->addObject(floor);
+
+    s->camera = std::make_shared<Camera>();
+    s->camera->setCamera(Point(x, 0, z), Point(0, 0, 1), Vector3D::back, 60);
+    s->background = Vector3D(0, 0, 0);
+    return s;
+}
+
+// torus around the z axis through the origin, major radius R, minor radius r, 2 * segments^2 triangles
+static std::shared_ptr<Model> createTorus(int segments, float R, float r) {
+    auto m = std::make_shared<Model>();
+    for (int i = 0; i < segments; i++) {
+        float u = Angle::degToRad(360.0f * i / segments);
+        for (int j = 0; j < segments; j++) {
+            float v = Angle::degToRad(360.0f * j / segments);
+            float d = R + r * std::cos(v);
+            m->vertex.emplace_back(d * std::cos(u), d * std::sin(u), r * std::sin(v));
+        }
+    }
+    for (int i = 0; i < segments; i++) {
+        for (int j = 0; j < segments; j++) {
+            int a = i * segments + j;
+            int b = (i + 1) % segments * segments + j;
+            int c = (i + 1) % segments * segments + (j + 1) % segments;
+            int d = i * segments + (j + 1) % segments;
+            m->index.insert(m->index.end(), {a, b, c, a, c, d});
+        }
+    }
+    m->build();
+    return m;
+}
+
+std::shared_ptr<Scene> createMeshScene(int segments) {
+    auto s = createRoom(6, 3);
+
+    auto torus = std::make_shared<Object>();
+    torus->mesh_filter = std::make_shared<Instance>(createTorus(segments, 1.6f, 0.6f), Transform::translate(Vector3D(0, 0, 1.2f)));
+    torus->mesh_renderer.material = std::make_shared<Material>(Vector3D(0.80, 0.69, 0.49), 0.8, 0.5, 64, 0);
+    s->addObject(torus);
+    return s;
+}
+
+std::shared_ptr<Scene> createInstancesScene(int count) {
+    auto s = createRoom(12, 6);
+
+    // one torus, its triangles and bvh are shared by every instance
+    auto torus = createTorus(128, 0.8f, 0.3f);
+    int side = std::max(1, (int)std::ceil(std::sqrt((float)count)));
+    float spacing = 16.0f / side;
+    Random rng(count);
+    for (int i = 0; i < count; i++) {
+        float x = -8 + spacing * (i % side + 0.5f);
+        float y = -8 + spacing * (i / side + 0.5f);
+        float size = spacing * (0.25f + 0.15f * rng.uniform());
+        Vector3D axis(rng.uniform() - 0.5f, rng.uniform() - 0.5f, rng.uniform() - 0.5f);
+        Transform t = Transform::translate(Vector3D(x, y, size * 1.1f)) * Transform::rotate(axis, 360 * rng.uniform()) *
+                      Transform::scale(size, size, size);
+
+        auto object = std::make_shared<Object>();
+        object->mesh_filter = std::make_shared<Instance>(torus, t);
+        object->mesh_renderer.material = std::make_shared<Material>(Vector3D(rng.uniform(), rng.uniform(), rng.uniform()), 0.8, 0.4, 64, 0);
+        s->addObject(object);
+    }
+    return s;
+}
+
+std::shared_ptr<Scene> createSpheresScene(int count) {
+    auto s = createRoom(12, 6);
+
+    int side = std::max(1, (int)std::ceil(std::sqrt((float)count)));
+    float spacing = 16.0f / side;
+    float radius = spacing * 0.4f;
+    Random rng(count);
+    for (int i = 0; i < count; i++) {
+        float x = -8 + spacing * (i % side + 0.5f);
+        float y = -8 + spacing * (i / side + 0.5f);
+        Vector3D color(rng.uniform(), rng.uniform(), rng.uniform());
+
+        auto sphere = std::make_shared<Object>();
+        sphere->mesh_filter = std::make_shared<Sphere>(Point(x, y, radius), radius);
+        if (i % 4 == 0) sphere->mesh_renderer.material = std::make_shared<Material>(color, 0.4, 0.8, 128, 1, Vector3D(0.65, 0.65, 0.65));
+        else sphere->mesh_renderer.material = std::make_shared<Material>(color, 0.8, 0.3, 32, 0);
+        s->addObject(sphere);
+    }
+    return s;
+}
+
+std::shared_ptr<Scene> createMirrorScene() {
+    auto s = createRoom(3.5, 1.5);
+
+    // two almost perfect mirrors facing each other, every ray bounces until max_depth
+    auto mirror = std::make_shared<Material>(Vector3D(0.95, 0.95, 0.95), 0.1, 0.9, 128, 1, Vector3D(0.95, 0.95, 0.95));
+    auto front = std::make_shared<Object>();
+    front->mesh_filter = std::make_shared<Plane>(Point(-4, -6, 0), Vector3D(0, 12, 0), Vector3D(0, 0, 6));
+    front->mesh_renderer.material = mirror;
+    s->addObject(front);
+    auto back = std::make_shared<Object>();
+    back->mesh_filter = std::make_shared<Plane>(Point(4, -6, 0), Vector3D(0, 0, 6), Vector3D(0, 12, 0));
+    back->mesh_renderer.material = mirror;
+    s->addObject(back);
+
+    // glass spheres split every ray in two
+    auto glass = std::make_shared<Material>(Vector3D(1, 1, 1), 0.35, 0.8, 128, 0, Vector3D(0.04, 0.04, 0.04), 1.5);
+    for (int i = 0; i < 5; i++) {
+        auto sphere = std::make_shared<Object>();
+        sphere->mesh_filter = std::make_shared<Sphere>(Point(-1.5 + 0.75 * i, -2 + i, 0.5 + 0.1 * i), 0.5);
+        sphere->mesh_renderer.material = glass;
+        s->addObject(sphere);
+    }
+    return s;
+}
+
+std::shared_ptr<Scene> createLightsScene(int count) {
+    auto s = createRoom(9, 5, false);
+
+    // a grid of small colored lights just above the objects, each one only reaching a few meters
+    int side = std::max(1, (int)std::ceil(std::sqrt((float)count)));
+    float spacing = 16.0f / side;
+    Random rng(count);
+    for (int i = 0; i < count; i++) {
+        Point p(-8 + spacing * (i % side + 0.5f), -8 + spacing * (i / side + 0.5f), 1.5f + rng.uniform());
+        Vector3D color(0.3f + 0.7f * rng.uniform(), 0.3f + 0.7f * rng.uniform(), 0.3f + 0.7f * rng.uniform());
+        s->addLight(std::make_shared<PointLight>(color * 0.4f, p, 3));
+    }
+
+    for (int i = 0; i < 16; i++) {
+        auto sphere = std::make_shared<Object>();
+        sphere->mesh_filter = std::make_shared<Sphere>(Point(-6 + 4 * (i % 4), -6 + 4 * (i / 4), 0.6), 0.6);
+        sphere->mesh_renderer.material = std::make_shared<Material>(Vector3D(0.9, 0.9, 0.9), 0.8, 0.4, 64, 0);
+        s->addObject(sphere);
+    }
+    return s;
+}
+
+std::shared_ptr<Scene> createScene(const std::string &name, const std::string &model_path) {
+    if (name == "demo") return createDemoScene(model_path);
+    if (name == "mesh") return createMeshScene(256);
+    if (name == "spheres") return createSpheresScene(1024);
+    if (name == "mirrors") return createMirrorScene();
+    if (name == "lights") return createLightsScene(256);
+    if (name == "instances") return createInstancesScene(400);
+    return nullptr;
+}
+
+std::vector<Model *> sceneModels(const Scene &scene) {
+    std::vector<Model *> models;
+    for (auto &object : scene.objects) {
+        Mesh *mesh = object->mesh_filter.get();
+        if (auto instance = dynamic_cast<Instance *>(mesh)) mesh = instance->mesh.get();
+        auto model = dynamic_cast<Model *>(mesh);
+        if (model && !model->mapping && std::find(models.begin(), models.end(), model) == models.end()) models.push_back(model);
+    }
+    return models;
+}
@@ -0,0 +1,82 @@
+#include "stats.h"
+#include <atomic>
+#include <fstream>
+#include <algorithm>
+
+Stats::Slot Stats::slots[Stats::max_threads];
+std::chrono::steady_clock::time_point Stats::epoch = std::chrono::steady_clock::now();
+
+static std::atomic<int> next_slot = 0;
+
+Stats::Slot &Stats::local() {
+    // a constant initializer keeps this a plain tls load, no guard on every count
+    static thread_local int slot = -1;
+    if (slot < 0) slot = std::min(next_slot++, max_threads - 1);
+    return slots[slot];
+}
+
+void Stats::reset() {
+    for (auto &s : slots) {
+        std::fill(std::begin(s.counter), std::end(s.counter), 0);
+        s.tiles.clear();
+    }
+    epoch = std::chrono::steady_clock::now();
+}
+
+double Stats::now() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+uint64_t Stats::total(Counter c) {
+    uint64_t ret = 0;
+    for (auto &s : slots) ret += s.counter[c];
+    return ret;
+}
+
+uint64_t Stats::rays() {
+    return total(primary_rays) + total(shadow_rays) + total(reflection_rays) + total(refraction_rays);
+}
+
+double Stats::occluderHitRate() {
+    uint64_t shadow = total(shadow_rays);
+    return shadow > 0 ? (double)total(occluder_hits) / shadow : 0;
+}
+
+void Stats::print(std::ostream &out, int slowest_tiles) {
+    for (int c = 0; c < counter_count; c++) {
+        out << counter_names[c] << ": " << total((Counter)c) << "\n";
+    }
+    out << "occluder_hit_rate: " << occluderHitRate() << "\n";
+
+    std::vector<TileTime> tiles;
+    for (auto &s : slots) tiles.insert(tiles.end(), s.tiles.begin(), s.tiles.end());
+    std::sort(tiles.begin(), tiles.end(), [](const TileTime &a, const TileTime &b) { return a.end - a.start > b.end - b.start; });
+    if (tiles.size() > (size_t)slowest_tiles) tiles.resize(slowest_tiles);
+    for (auto &t : tiles) {
+        out << "tile (" << t.x0 << ", " << t.y0 << ") - (" << t.x1 << ", " << t.y1 << "): " << (t.end - t.start) / 1000 << " ms\n";
+    }
+    out.flush();
+}
+
+bool Stats::writeTrace(const std::string &path) {
+    std::ofstream out(path);
+    if (!out) return false;
+
+    // complete events ("ph": "X"), one row per render thread, counter totals go to otherData
+    out << "{\"traceEvents\": [\n";
+    bool first = true;
+    for (int i = 0; i < max_threads; i++) {
+        for (auto &t : slots[i].tiles) {
+            out << (first ? "" : ",\n") << "{\"name\": \"tile " << t.x0 << "," << t.y0 << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << i
+                << ", \"ts\": " << t.start << ", \"dur\": " << t.end - t.start
+                << ", \"args\": {\"x0\": " << t.x0 << ", \"y0\": " << t.y0 << ", \"x1\": " << t.x1 << ", \"y1\": " << t.y1 << "}}";
+            first = false;
+        }
+    }
+    out << "\n],\n\"otherData\": {";
+    for (int c = 0; c < counter_count; c++) {
+        out << (c ? ", " : "") << "\"" << counter_names[c] << "\": " << total((Counter)c);
+    }
+    out << "}}\n";
+    return (bool)out;
+}
@@ -0,0 +1,63 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(int threads) {
+    if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 0; i < threads - 1; i++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    work_cv.notify_all();
+    for (auto &w : workers) w.join();
+}
+
+int ThreadPool::size() const {
+    return workers.size() + 1;
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int)> &func) {
+    if (count <= 0) return;
+    std::lock_guard<std::mutex> submit_lock(submit_mutex);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    job = &func;
+    job_count = count;
+    next_task = 0;
+    busy = workers.size();
+    generation++;
+    lock.unlock();
+    work_cv.notify_all();
+
+    runTasks();
+
+    lock.lock();
+    done_cv.wait(lock, [this]() { return busy == 0; });
+    job = nullptr;
+}
+
+void ThreadPool::workerLoop() {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        work_cv.wait(lock, [&]() { return stop || generation != seen; });
+        if (stop) return;
+        seen = generation;
+
+        lock.unlock();
+        runTasks();
+        lock.lock();
+
+        if (--busy == 0) done_cv.notify_one();
+    }
+}
+
+void ThreadPool::runTasks() {
+    for (int task = next_task++; task < job_count; task = next_task++) {
+        (*job)(task);
+    }
+}
@@ -0,0 +1,103 @@
+#include "transform.h"
+
+Transform::Transform() {
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) m[i][j] = i == j ? 1.0f : 0.0f;
+    }
+}
+
+Transform Transform::translate(const Vector3D &v) {
+    Transform t;
+    t.m[0][3] = v.x;
+    t.m[1][3] = v.y;
+    t.m[2][3] = v.z;
+    return t;
+}
+
+Transform Transform::scale(float x, float y, float z) {
+    Transform t;
+    t.m[0][0] = x;
+    t.m[1][1] = y;
+    t.m[2][2] = z;
+    return t;
+}
+
+/**
+ *  rodrigues' formula, a = normalized axis, c = cos, s = sin:
+ *  R = c * I + s * [a]x + (1 - c) * a * a^T
+ */
+Transform Transform::rotate(const Vector3D &axis, float deg) {
+    Vector3D a = axis.normalized();
+    float rad = Angle::degToRad(deg);
+    float c = std::cos(rad), s = std::sin(rad), k = 1 - c;
+
+    Transform t;
+    t.m[0][0] = c + k * a.x * a.x;
+    t.m[0][1] = k * a.x * a.y - s * a.z;
+    t.m[0][2] = k * a.x * a.z + s * a.y;
+    t.m[1][0] = k * a.y * a.x + s * a.z;
+    t.m[1][1] = c + k * a.y * a.y;
+    t.m[1][2] = k * a.y * a.z - s * a.x;
+    t.m[2][0] = k * a.z * a.x - s * a.y;
+    t.m[2][1] = k * a.z * a.y + s * a.x;
+    t.m[2][2] = c + k * a.z * a.z;
+    return t;
+}
+
+Transform Transform::operator*(const Transform &t) const {
+    Transform ret;
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            ret.m[i][j] = 0;
+            for (int k = 0; k < 4; k++) ret.m[i][j] += m[i][k] * t.m[k][j];
+        }
+    }
+    return ret;
+}
+
+/**
+ *  [A t]^-1   [A^-1  -A^-1 t]
+ *  [0 1]    = [0      1     ]
+ *  A^-1 is the adjugate over the determinant
+ */
+Transform Transform::inverse() const {
+    float det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+              - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+              + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    assert(!fequal(det, 0));
+    float inv = 1 / det;
+
+    Transform ret;
+    ret.m[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * inv;
+    ret.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv;
+    ret.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv;
+    ret.m[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * inv;
+    ret.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv;
+    ret.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv;
+    ret.m[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * inv;
+    ret.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv;
+    ret.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv;
+
+    for (int i = 0; i < 3; i++) {
+        ret.m[i][3] = -(ret.m[i][0] * m[0][3] + ret.m[i][1] * m[1][3] + ret.m[i][2] * m[2][3]);
+    }
+    return ret;
+}
+
+Point Transform::apply(const Point &p) const {
+    return Point(m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+                 m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+                 m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3]);
+}
+
+Vector3D Transform::apply(const Vector3D &v) const {
+    return Vector3D(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+                    m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+                    m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z);
+}
+
+Vector3D Transform::applyNormal(const Vector3D &n) const {
+    return Vector3D(m[0][0] * n.x + m[1][0] * n.y + m[2][0] * n.z,
+                    m[0][1] * n.x + m[1][1] * n.y + m[2][1] * n.z,
+                    m[0][2] * n.x + m[1][2] * n.y + m[2][2] * n.z);
+}
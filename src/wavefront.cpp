@@ -0,0 +1,224 @@
+#include <algorithm>
+#include "wavefront.h"
+#include "objects.h"
+#include "stats.h"
+
+void RayQueue::clear() {
+    for (auto *v : {&ox, &oy, &oz, &dx, &dy, &dz, &wr, &wg, &wb}) v->clear();
+    pixel.clear();
+    depth.clear();
+}
+
+void RayQueue::reserve(int n) {
+    for (auto *v : {&ox, &oy, &oz, &dx, &dy, &dz, &wr, &wg, &wb}) v->reserve(n);
+    pixel.reserve(n);
+    depth.reserve(n);
+}
+
+void RayQueue::resize(int n) {
+    for (auto *v : {&ox, &oy, &oz, &dx, &dy, &dz, &wr, &wg, &wb}) v->resize(n);
+    pixel.resize(n);
+    depth.resize(n);
+}
+
+void RayQueue::push(const Ray &ray, const Vector3D &weight, int pixel, int depth) {
+    ox.push_back(ray.start.x), oy.push_back(ray.start.y), oz.push_back(ray.start.z);
+    dx.push_back(ray.dir.x), dy.push_back(ray.dir.y), dz.push_back(ray.dir.z);
+    wr.push_back(weight.x), wg.push_back(weight.y), wb.push_back(weight.z);
+    this->pixel.push_back(pixel);
+    this->depth.push_back(depth);
+}
+
+Ray RayQueue::ray(int i) const {
+    Ray ray;
+    ray.start = Point(ox[i], oy[i], oz[i]);
+    ray.dir = Vector3D(dx[i], dy[i], dz[i]);
+    return ray;
+}
+
+Hit Wavefront::hit(int i) const {
+    return Hit{Point(hx[i], hy[i], hz[i]), Vector3D(nx[i], ny[i], nz[i]), dist[i], object[i]};
+}
+
+void Wavefront::trace(Scene &scene, const float *x, const float *y, int count, int windowWidth, int windowHeight, Vector3D *color,
+                      Hit *primary) {
+    // ray generation
+    queue.clear();
+    queue.reserve(count);
+    for (int i = 0; i < count; i++) {
+        queue.push(scene.camera->getRay(x[i], y[i], windowWidth, windowHeight), Vector3D(1, 1, 1), i, 0);
+        color[i] = Vector3D::zero;
+    }
+    RT_COUNT(primary_rays, count);
+
+    for (int depth = 0; queue.size() > 0; depth++) {
+        intersect(scene);
+        if (depth == 0 && primary) {
+            for (int i = 0; i < queue.size(); i++) primary[queue.pixel[i]] = object[i] < 0 ? Hit() : hit(i);
+        }
+        shade(scene, color);
+        spawn(scene);
+    }
+}
+
+// closest hit of every queue entry, 8 rays at a time
+void Wavefront::intersect(Scene &scene) {
+    RT_TIMER(intersect_ns);
+    int n = queue.size();
+#ifdef RT_STATS
+    uint64_t nodes = Stats::local().counter[Stats::bvh_nodes];
+#endif
+    for (auto *v : {&hx, &hy, &hz, &nx, &ny, &nz, &dist}) v->resize(n);
+    object.resize(n);
+
+    for (int i = 0; i < n; i += RayPacket::size) {
+        RayPacket packet;
+        packet.count = std::min(RayPacket::size, n - i);
+        for (int l = 0; l < RayPacket::size; l++) {
+            // inactive lanes repeat the last ray, so every lane holds valid numbers
+            packet.set(l, queue.ray(i + std::min(l, packet.count - 1)));
+        }
+
+        PacketHit packet_hit(packet);
+        scene.getIntersection(packet, packet_hit);
+
+        for (int l = 0; l < packet.count; l++) {
+            int k = i + l;
+            if (!packet_hit.hit(l)) {
+                object[k] = -1;
+                continue;
+            }
+
+            Hit h = packet_hit.get(packet, l);
+            hx[k] = h.point.x, hy[k] = h.point.y, hz[k] = h.point.z;
+            nx[k] = h.normal.x, ny[k] = h.normal.y, nz[k] = h.normal.z;
+            dist[k] = h.t;
+            object[k] = h.object;
+        }
+    }
+
+#ifdef RT_STATS
+    // every entry of a queue has the same depth
+    if (n > 0 && queue.depth[0] > 0) RT_COUNT(secondary_nodes, Stats::local().counter[Stats::bvh_nodes] - nodes);
+#endif
+}
+
+// background for misses, ambient and direct lights for hits, weighted into the pixel
+void Wavefront::shade(Scene &scene, Vector3D *color) {
+    RT_TIMER(shade_ns);
+    int n = queue.size();
+    for (int i = 0; i < n; i++) {
+        Vector3D weight = queue.weight(i);
+        if (object[i] < 0) {
+            color[queue.pixel[i]] = color[queue.pixel[i]] + weight * scene.background;
+            continue;
+        }
+
+        Vector3D V(queue.dx[i], queue.dy[i], queue.dz[i]);
+        Vector3D ambient = scene.ambient_light->getColor(hit(i), scene.material(hit(i)), V);
+        color[queue.pixel[i]] = color[queue.pixel[i]] + weight * ambient;
+    }
+
+    // shadow rays towards the lights each hit selected, their weight is the entry's throughput
+    // times the light's sampling weight
+    shadow.clear();
+    shadow_t.clear();
+    shadow_entry.clear();
+    shadow_light.clear();
+    for (int i = 0; i < n; i++) {
+        if (object[i] < 0) continue;
+
+        int light[Scene::max_light_samples];
+        float weight[Scene::max_light_samples];
+        int count = scene.selectLights(hit(i), light, weight);
+        for (int k = 0; k < count; k++) {
+            Ray ray;
+            float t_max;
+            if (!scene.light_list[light[k]]->shadowRay(hit(i), Vector3D(queue.dx[i], queue.dy[i], queue.dz[i]), ray, t_max)) continue;
+
+            shadow.push(ray, weight[k] * queue.weight(i), queue.pixel[i], queue.depth[i]);
+            shadow_t.push_back(t_max);
+            shadow_entry.push_back(i);
+            shadow_light.push_back(light[k]);
+        }
+    }
+
+    int m = shadow.size();
+    for (int j = 0; j < m; j += RayPacket::size) {
+        RayPacket packet;
+        packet.count = std::min(RayPacket::size, m - j);
+        alignas(32) float t_max[RayPacket::size];
+        for (int l = 0; l < RayPacket::size; l++) {
+            int k = j + std::min(l, packet.count - 1);
+            packet.set(l, shadow.ray(k));
+            t_max[l] = shadow_t[k];
+        }
+
+        unsigned lit = packet.active() & ~scene.occluded(packet, Ray::offset, t_max, packet.active(), shadow_light.data() + j);
+        for (int l = 0; l < packet.count; l++) {
+            if (!(lit >> l & 1)) continue;
+            int i = shadow_entry[j + l];
+            Vector3D V(queue.dx[i], queue.dy[i], queue.dz[i]);
+            Vector3D direct = scene.light_list[shadow_light[j + l]]->getLitColor(hit(i), scene.material(hit(i)), V);
+            color[queue.pixel[i]] = color[queue.pixel[i]] + shadow.weight(j + l) * direct;
+        }
+    }
+}
+
+// reflected and refracted rays of the hits become the next queue
+void Wavefront::spawn(Scene &scene) {
+    RT_TIMER(spawn_ns);
+    reflected.clear();
+    refracted.clear();
+
+    int n = queue.size();
+    for (int i = 0; i < n; i++) {
+        // Scene::rayTrace returns black past max_depth, so those rays aren't queued at all
+        if (object[i] < 0 || queue.depth[i] >= scene.max_depth) continue;
+
+        Ray rays[2];
+        Vector3D weights[2];
+        int count = scene.scatter(queue.ray(i), hit(i), rays, weights);
+        Vector3D weight = queue.weight(i);
+        int depth = queue.depth[i] + 1;
+        if (count > 0 && scene.survive(rays[0], depth, weight, weights[0])) reflected.push(rays[0], weight * weights[0], queue.pixel[i], depth);
+        if (count > 1 && scene.survive(rays[1], depth, weight, weights[1])) refracted.push(rays[1], weight * weights[1], queue.pixel[i], depth);
+    }
+
+    RT_COUNT(reflection_rays, reflected.size());
+    RT_COUNT(refraction_rays, refracted.size());
+
+    // reflections first, then refractions
+    std::swap(queue, reflected);
+    for (int i = 0; i < refracted.size(); i++) {
+        queue.push(refracted.ray(i), refracted.weight(i), refracted.pixel[i], refracted.depth[i]);
+    }
+    if (scene.sort_rays) sort(scene);
+}
+
+// order the queue by direction octant, then along a morton curve over the scene bounds by origin
+void Wavefront::sort(Scene &scene) {
+    RT_TIMER(sort_ns);
+    int n = queue.size();
+    if (n <= RayPacket::size || scene.bvh.empty()) return;
+
+    const AABB &box = scene.bvh.nodes[0].box;
+    key.resize(n);
+    for (int i = 0; i < n; i++) {
+        uint64_t octant = (queue.dx[i] < 0) << 2 | (queue.dy[i] < 0) << 1 | (queue.dz[i] < 0);
+        uint64_t cell = BVH::morton(Point(queue.ox[i], queue.oy[i], queue.oz[i]), box);
+        key[i] = (octant << 30 | cell) << 32 | i;
+    }
+    std::sort(key.begin(), key.end());
+
+    sorted.resize(n);
+    for (int j = 0; j < n; j++) {
+        int i = key[j] & 0xFFFFFFFF;
+        sorted.ox[j] = queue.ox[i], sorted.oy[j] = queue.oy[i], sorted.oz[j] = queue.oz[i];
+        sorted.dx[j] = queue.dx[i], sorted.dy[j] = queue.dy[i], sorted.dz[j] = queue.dz[i];
+        sorted.wr[j] = queue.wr[i], sorted.wg[j] = queue.wg[i], sorted.wb[j] = queue.wb[i];
+        sorted.pixel[j] = queue.pixel[i];
+        sorted.depth[j] = queue.depth[i];
+    }
+    std::swap(queue, sorted);
+}
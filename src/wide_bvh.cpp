@@ -0,0 +1,163 @@
+#include "wide_bvh.h"
+
+static_assert(sizeof(WideBVH::Node) == 64);
+
+namespace {
+
+// a child of a wide node while converting: a binary node, or a range of leaf primitives of one
+struct Item {
+    AABB box;
+    int node;         // binary interior node, -1 for a leaf range
+    int first, count; // leaf primitives, positions in BVH::index
+};
+
+struct WideBuild {
+    const BVH &bvh;
+    const std::vector<Point> &vertex;
+    const std::vector<int> &index;
+    WideBVH &wide;
+    std::vector<std::pair<int, int>> range; // primitives under each binary node, a subtree covers a contiguous range
+
+    AABB bounds(int first, int count) const;
+    Item item(int node) const;
+    int block(int first, int count);
+    int node(std::vector<Item> items);
+};
+
+AABB WideBuild::bounds(int first, int count) const {
+    // the bounds of Triangle, like the boxes the binary bvh was built from
+    AABB box;
+    for (int j = first; j < first + count; j++) {
+        const int *v = index.data() + 3 * bvh.index[j];
+        box.expand(Triangle(vertex[v[0]], vertex[v[1]], vertex[v[2]]).bounds());
+    }
+    return box;
+}
+
+Item WideBuild::item(int node) const {
+    // small subtrees become one block, their triangles share more vertices than the binary leaves
+    auto [first, count] = range[node];
+    if (count <= WideBVH::leaf_size || bvh.nodes[node].count > 0) return {bvh.nodes[node].box, -1, first, count};
+    return {bvh.nodes[node].box, node, 0, 0};
+}
+
+// a leaf block, vertices shared by its triangles are stored once
+int WideBuild::block(int first, int count) {
+    WideBVH::Block b{(int)wide.vertices.size(), (int)wide.corner.size() / 3};
+    std::vector<int> used; // source vertex of each block vertex, at most 3 * max_block
+    for (int j = first; j < first + count; j++) {
+        for (int c = 0; c < 3; c++) {
+            int v = index[3 * bvh.index[j] + c];
+            int k = std::find(used.begin(), used.end(), v) - used.begin();
+            if (k == (int)used.size()) {
+                used.push_back(v);
+                wide.vertices.push_back(vertex[v]);
+            }
+            wide.corner.push_back(k);
+        }
+    }
+    wide.blocks.push_back(b);
+    return wide.blocks.size() - 1;
+}
+
+/**
+ *  collapse: open the interior item with the largest surface area until there are width items, so the
+ *  children of a wide node are the binary nodes up to two levels down that a ray is most likely to hit
+ *
+ *  quantization per axis: step = 2^e with 255 * step >= extent of the node box, child bounds are rounded
+ *  outwards in the same float arithmetic the traversal decodes them with, so a decoded box always contains
+ *  the child
+ */
+int WideBuild::node(std::vector<Item> items) {
+    for (;;) {
+        int open = -1;
+        for (int i = 0; i < (int)items.size(); i++) {
+            if (items[i].node >= 0 && (open == -1 || items[i].box.surfaceArea() > items[open].box.surfaceArea())) open = i;
+        }
+        if (open == -1 || (int)items.size() + 1 > WideBVH::width) break;
+
+        const BVH::Node &n = bvh.nodes[items[open].node];
+        items[open] = item(n.first);
+        items.push_back(item(n.first + 1));
+    }
+
+    int ret = wide.nodes.size();
+    wide.nodes.emplace_back();
+
+    AABB box;
+    for (auto &it : items) box.expand(it.box);
+
+    WideBVH::Node n = {};
+    n.children = items.size();
+    for (int axis = 0; axis < 3; axis++) {
+        float lo = (&box.min.x)[axis], hi = (&box.max.x)[axis];
+        int e;
+        std::frexp((hi - lo) / 255, &e);
+        e = std::clamp(e, -126, 127);
+        while (e < 127 && lo + 255 * std::ldexp(1.0f, e) < hi) e++;
+        float step = std::ldexp(1.0f, e);
+
+        n.origin[axis] = lo;
+        n.exponent[axis] = e;
+        for (int i = 0; i < (int)items.size(); i++) {
+            float child_lo = (&items[i].box.min.x)[axis], child_hi = (&items[i].box.max.x)[axis];
+            int q_lo = std::clamp((int)std::floor((child_lo - lo) / step), 0, 255);
+            while (q_lo > 0 && lo + q_lo * step > child_lo) q_lo--;
+            int q_hi = std::clamp((int)std::ceil((child_hi - lo) / step), 0, 255);
+            while (q_hi < 255 && lo + q_hi * step < child_hi) q_hi++;
+            n.lo[axis][i] = q_lo;
+            n.hi[axis][i] = q_hi;
+        }
+    }
+
+    for (int i = 0; i < (int)items.size(); i++) {
+        auto &it = items[i];
+        if (it.node >= 0) {
+            const BVH::Node &b = bvh.nodes[it.node];
+            n.child[i] = node({item(b.first), item(b.first + 1)});
+        }
+        else if (it.count <= WideBVH::max_block) {
+            n.child[i] = block(it.first, it.count);
+            n.count[i] = it.count;
+        }
+        else {
+            // an oversized leaf, cut it into up to width ranges under a node of its own
+            std::vector<Item> parts;
+            int size = (it.count + WideBVH::width - 1) / WideBVH::width;
+            for (int first = it.first; first < it.first + it.count; first += size) {
+                int count = std::min(size, it.first + it.count - first);
+                parts.push_back({bounds(first, count), -1, first, count});
+            }
+            n.child[i] = node(parts);
+        }
+    }
+
+    wide.nodes[ret] = n;
+    return ret;
+}
+
+}
+
+void WideBVH::build(const BVH &bvh, const std::vector<Point> &vertex, const std::vector<int> &index) {
+    nodes.clear();
+    blocks.clear();
+    corner.clear();
+    vertices.clear();
+    box = AABB();
+    if (bvh.empty()) return;
+
+    WideBuild build{bvh, vertex, index, *this, std::vector<std::pair<int, int>>(bvh.nodes.size())};
+    for (int i = (int)bvh.nodes.size() - 1; i >= 0; i--) {
+        const BVH::Node &n = bvh.nodes[i];
+        if (n.count > 0) build.range[i] = {n.first, n.count};
+        else build.range[i] = {build.range[n.first].first, build.range[n.first].second + build.range[n.first + 1].second};
+    }
+    box = bvh.nodes[0].box;
+    Item root = build.item(0);
+    if (root.node < 0) build.node({root});
+    else build.node({build.item(bvh.nodes[0].first), build.item(bvh.nodes[0].first + 1)});
+}
+
+size_t WideBVH::bytes() const {
+    return nodes.size() * sizeof(Node) + blocks.size() * sizeof(Block) + corner.size() + vertices.size() * sizeof(Point);
+}